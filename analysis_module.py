@@ -5,7 +5,6 @@ import matplotlib.pyplot as plt
 
 from sklearn.svm import SVC
 from sklearn.model_selection import train_test_split
-from sklearn.model_selection import GridSearchCV
 from sklearn.model_selection import learning_curve
 from sklearn.model_selection import ShuffleSplit
 from sklearn.metrics import roc_curve,auc
@@ -30,6 +29,9 @@ EigenNames = []
 EigenSpace = []
 Lable = []
 
+# Whether the dataset differs from the one written to Data.csv last time
+DataChanged = True
+
 # Train dataset
 TrainEigenSpace = []
 TrainEigenSpaceNormalized = []
@@ -50,10 +52,18 @@ Clf = SVC()
 
 # Something to do
 def Run():
-    LoadData()
-    WriteDataFile()
+    if len(EigenSpace) == 0:
+        LoadData()
+    if DataChanged or not os.path.exists(WorkPath + AnalysisMidPath + DataFileName):
+        WriteDataFile()
     SplitAndNormalize()
-    GridSearchParam()
+
+def Analyze(C, gamma):
+    global Clf
+    global TrainEigenSpaceNormalized
+    global TrainLable
+    Clf = SVC(kernel = 'rbf', C = C, gamma = gamma)
+    Clf.fit(TrainEigenSpaceNormalized, TrainLable)
     LearningCurve()
     ROCCurve()
 
@@ -61,6 +71,16 @@ def SetWorkPath(workPath):
     global WorkPath
     WorkPath = workPath
 
+def SetData(eigenNames, eigenSpace, lable, dataChanged):
+    global EigenNames
+    global EigenSpace
+    global Lable
+    global DataChanged
+    EigenNames = eigenNames
+    EigenSpace = np.frombuffer(eigenSpace, dtype=np.float64).reshape(-1, len(eigenNames))
+    Lable = np.frombuffer(lable, dtype=np.float64)
+    DataChanged = dataChanged
+
 def LoadData():
     global WorkPath
     global DataMidPath
@@ -140,12 +160,8 @@ def Normalize(DataSpace):
     global RatioInNormalization
     global TrainMeanInNormalization
     global TrainStdInNormalization
-    Array = np.array(DataSpace)
-    [row,col] = np.shape(DataSpace)
-    for i in range(row):
-        for j in range(col):
-            Array[i,j] = ((Array[i,j] - TrainMeanInNormalization[j])/TrainStdInNormalization[j])*RatioInNormalization
-    return Array.tolist()
+    Array = np.asarray(DataSpace, dtype=np.float64)
+    return ((Array - TrainMeanInNormalization)/TrainStdInNormalization)*RatioInNormalization
 
 def SplitAndNormalize():
     global EigenSpace
@@ -164,17 +180,6 @@ def SplitAndNormalize():
     TrainEigenSpaceNormalized = Normalize(TrainEigenSpace)
     TestEigenSpaceNormalized = Normalize(TestEigenSpace)
 
-def GridSearchParam():
-    global Clf
-    C_range = np.logspace(-4, 5, 10)
-    gamma_range = np.logspace(-9, 3, 13)
-    kernel = ['rbf']
-    ParamGrid = dict(gamma = gamma_range, C = C_range, kernel = kernel)
-    Cv = ShuffleSplit(n_splits = 10, test_size = 0.2, random_state = 1)
-    Svc = GridSearchCV(SVC(), param_grid = ParamGrid, cv = Cv)
-    Svc.fit(TrainEigenSpaceNormalized, TrainLable)
-    Clf = Svc.best_estimator_
-
 def LearningCurve():
     global Clf
     global TrainEigenSpaceNormalized
@@ -239,7 +244,7 @@ def GetLable():
 
 def GetTrainEigenSpace():
     global TrainEigenSpace
-    return TrainEigenSpace
+    return np.ascontiguousarray(TrainEigenSpace, dtype=np.float64)
 
 def GetTrainEigenSpaceNormalized():
     global TrainEigenSpaceNormalized
@@ -247,11 +252,11 @@ def GetTrainEigenSpaceNormalized():
 
 def GetTrainLable():
     global TrainLable
-    return TrainLable
+    return np.ascontiguousarray(TrainLable, dtype=np.float64)
 
 def GetTestEigenSpace():
     global TestEigenSpace
-    return TestEigenSpace
+    return np.ascontiguousarray(TestEigenSpace, dtype=np.float64)
 
 def GetTestEigenSpaceNormalized():
     global TestEigenSpaceNormalized
@@ -259,13 +264,12 @@ def GetTestEigenSpaceNormalized():
 
 def GetTestLable():
     global TestLable
-    return TestLable
+    return np.ascontiguousarray(TestLable, dtype=np.float64)
 
 def GetTrainMeanAndStdInNormalization():
     global TrainMeanInNormalization
     global TrainStdInNormalization
-    list_value = np.vstack((TrainMeanInNormalization,TrainStdInNormalization))
-    return list_value.tolist()
+    return np.ascontiguousarray(np.vstack((TrainMeanInNormalization,TrainStdInNormalization)), dtype=np.float64)
 
 def GetRatioInNormalization():
     global RatioInNormalization
@@ -273,4 +277,4 @@ def GetRatioInNormalization():
 
 def GetSVCParams():
     global Clf
-    return [Clf.C, Clf.cache_size, Clf.degree, Clf.gamma, Clf.tol]
+    return [float(Clf.cache_size), float(Clf.degree), float(Clf.tol)]
@@ -0,0 +1,317 @@
+﻿#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include "dataset_cache.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+const char * const DatasetCache::FILE_MAGIC = "PJDATA\0\0";
+
+DatasetCache::DatasetCache()
+{
+	mData = nullptr;
+	mSize = 0;
+#ifdef _WIN32
+	mFileHandle = INVALID_HANDLE_VALUE;
+	mMappingHandle = nullptr;
+#else
+	mFileHandle = -1;
+#endif
+	mColumns = nullptr;
+	mLabel = nullptr;
+	mNumOfRows = 0;
+}
+
+DatasetCache::~DatasetCache()
+{
+	Close();
+}
+
+bool DatasetCache::Map(const string path)
+{
+#ifdef _WIN32
+	mFileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mFileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFileHandle, &fileSize) || fileSize.QuadPart == 0) {
+		Unmap();
+		return false;
+	}
+	mSize = (size_t)fileSize.QuadPart;
+
+	mMappingHandle = CreateFileMappingA(mFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mMappingHandle == nullptr) {
+		Unmap();
+		return false;
+	}
+
+	mData = (const char *)MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (mData == nullptr) {
+		Unmap();
+		return false;
+	}
+#else
+	mFileHandle = open(path.c_str(), O_RDONLY);
+	if (mFileHandle < 0) {
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(mFileHandle, &fileStat) != 0 || fileStat.st_size == 0) {
+		Unmap();
+		return false;
+	}
+	mSize = (size_t)fileStat.st_size;
+
+	void *data = mmap(NULL, mSize, PROT_READ, MAP_SHARED, mFileHandle, 0);
+	if (data == MAP_FAILED) {
+		Unmap();
+		return false;
+	}
+	mData = (const char *)data;
+#endif
+	return true;
+}
+
+void DatasetCache::Unmap()
+{
+#ifdef _WIN32
+	if (mData) {
+		UnmapViewOfFile(mData);
+	}
+	if (mMappingHandle) {
+		CloseHandle(mMappingHandle);
+	}
+	if (mFileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(mFileHandle);
+	}
+	mMappingHandle = nullptr;
+	mFileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (mData) {
+		munmap((void *)mData, mSize);
+	}
+	if (mFileHandle >= 0) {
+		close(mFileHandle);
+	}
+	mFileHandle = -1;
+#endif
+	mData = nullptr;
+	mSize = 0;
+}
+
+bool DatasetCache::ParseHeader(uint64_t labelStamp)
+{
+	FileHeader header;
+	if (mSize < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, mData, sizeof(header));
+
+	if (memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != FILE_VERSION
+		|| header.fileSize != mSize
+		|| header.columnsOffset % sizeof(double) != 0
+		|| header.columnsOffset + header.numOfEigenElem * header.numOfRows * sizeof(double) != header.labelOffset
+		|| header.labelOffset + header.numOfRows * sizeof(double) != mSize) {
+		return false;
+	}
+
+	if (header.labelStamp != labelStamp) {
+		cout << "DatasetCache: label config changed, labels in the cache are stale" << endl;
+		return false;
+	}
+
+	// Eigen names and scene table are small, copy them out of the mapping
+	size_t pos = sizeof(header);
+	uint32_t len;
+
+	for (uint32_t i = 0; i < header.numOfEigenElem; i++) {
+		if (pos + sizeof(len) > header.columnsOffset) {
+			return false;
+		}
+		memcpy(&len, mData + pos, sizeof(len));
+		pos += sizeof(len);
+		if (pos + len > header.columnsOffset) {
+			return false;
+		}
+		mEigenNames.push_back(string(mData + pos, len));
+		pos += len;
+	}
+
+	for (uint64_t i = 0; i < header.numOfScenes; i++) {
+		SceneInfo scene;
+		if (pos + sizeof(len) > header.columnsOffset) {
+			return false;
+		}
+		memcpy(&len, mData + pos, sizeof(len));
+		pos += sizeof(len);
+		if (pos + len + 3 * sizeof(uint64_t) > header.columnsOffset) {
+			return false;
+		}
+		scene.name.assign(mData + pos, len);
+		pos += len;
+		memcpy(&scene.stamp, mData + pos, sizeof(uint64_t));
+		memcpy(&scene.rowBegin, mData + pos + sizeof(uint64_t), sizeof(uint64_t));
+		memcpy(&scene.numOfRows, mData + pos + 2 * sizeof(uint64_t), sizeof(uint64_t));
+		pos += 3 * sizeof(uint64_t);
+
+		if (scene.rowBegin + scene.numOfRows > header.numOfRows) {
+			return false;
+		}
+		mSceneIndex[scene.name] = mScenes.size();
+		mScenes.push_back(scene);
+	}
+
+	mNumOfRows = header.numOfRows;
+	mColumns = (const double *)(mData + header.columnsOffset);
+	mLabel = (const double *)(mData + header.labelOffset);
+	return true;
+}
+
+bool DatasetCache::Open(const string path, uint64_t labelStamp)
+{
+	Close();
+
+	if (!Map(path)) {
+		return false;
+	}
+
+	if (!ParseHeader(labelStamp)) {
+		cout << "DatasetCache: ignore invalid cache file " << path << endl;
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void DatasetCache::Close()
+{
+	Unmap();
+	mEigenNames.clear();
+	mScenes.clear();
+	mSceneIndex.clear();
+	mColumns = nullptr;
+	mLabel = nullptr;
+	mNumOfRows = 0;
+}
+
+const DatasetCache::SceneInfo * DatasetCache::FindScene(const string &name, uint64_t stamp) const
+{
+	map<string, size_t>::const_iterator it = mSceneIndex.find(name);
+	if (it == mSceneIndex.end() || mScenes[it->second].stamp == 0 || mScenes[it->second].stamp != stamp) {
+		return nullptr;
+	}
+	return &mScenes[it->second];
+}
+
+void DatasetCache::CopyRows(uint64_t rowBegin, uint64_t numOfRows, double *eigenSpace, double *label) const
+{
+	size_t numOfEigenElem = mEigenNames.size();
+
+	for (size_t j = 0; j < numOfEigenElem; j++) {
+		const double *column = mColumns + j * mNumOfRows + rowBegin;
+		for (uint64_t i = 0; i < numOfRows; i++) {
+			eigenSpace[i * numOfEigenElem + j] = column[i];
+		}
+	}
+	memcpy(label, mLabel + rowBegin, numOfRows * sizeof(double));
+}
+
+bool DatasetCache::Write(const string path, uint64_t labelStamp, const vector<string> &eigenNames, const vector<SceneInfo> &scenes,
+	const vector<double> &eigenSpace, const vector<double> &label)
+{
+	size_t numOfEigenElem = eigenNames.size();
+	uint64_t numOfRows = label.size();
+
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+	header.version = FILE_VERSION;
+	header.numOfEigenElem = (uint32_t)numOfEigenElem;
+	header.numOfRows = numOfRows;
+	header.numOfScenes = scenes.size();
+	header.labelStamp = labelStamp;
+
+	// Serialize names and scene table to know where the columns start
+	vector<char> table;
+	uint32_t len;
+	for (size_t i = 0; i < numOfEigenElem; i++) {
+		len = (uint32_t)eigenNames[i].size();
+		table.insert(table.end(), (const char *)&len, (const char *)&len + sizeof(len));
+		table.insert(table.end(), eigenNames[i].begin(), eigenNames[i].end());
+	}
+	for (size_t i = 0; i < scenes.size(); i++) {
+		len = (uint32_t)scenes[i].name.size();
+		table.insert(table.end(), (const char *)&len, (const char *)&len + sizeof(len));
+		table.insert(table.end(), scenes[i].name.begin(), scenes[i].name.end());
+		table.insert(table.end(), (const char *)&scenes[i].stamp, (const char *)&scenes[i].stamp + sizeof(uint64_t));
+		table.insert(table.end(), (const char *)&scenes[i].rowBegin, (const char *)&scenes[i].rowBegin + sizeof(uint64_t));
+		table.insert(table.end(), (const char *)&scenes[i].numOfRows, (const char *)&scenes[i].numOfRows + sizeof(uint64_t));
+	}
+	while ((sizeof(header) + table.size()) % sizeof(double) != 0) {
+		table.push_back(0);
+	}
+
+	header.columnsOffset = sizeof(header) + table.size();
+	header.labelOffset = header.columnsOffset + numOfEigenElem * numOfRows * sizeof(double);
+	header.fileSize = header.labelOffset + numOfRows * sizeof(double);
+
+	// Write to a temporary file and replace the old one at last
+	string tmpPath = path + ".tmp";
+	FILE *fp;
+	fopen_s(&fp, tmpPath.c_str(), "wb");
+	if (fp == nullptr) {
+		cout << "DatasetCache: can not open " << tmpPath << endl;
+		return false;
+	}
+
+	fwrite(&header, sizeof(header), 1, fp);
+	if (!table.empty()) {
+		fwrite(&table[0], 1, table.size(), fp);
+	}
+
+	vector<double> column(numOfRows);
+	for (size_t j = 0; j < numOfEigenElem; j++) {
+		for (uint64_t i = 0; i < numOfRows; i++) {
+			column[i] = eigenSpace[i * numOfEigenElem + j];
+		}
+		if (numOfRows) {
+			fwrite(&column[0], sizeof(double), numOfRows, fp);
+		}
+	}
+	if (numOfRows) {
+		fwrite(&label[0], sizeof(double), numOfRows, fp);
+	}
+
+	// Close even after a write error, an open file can not be removed on Windows
+	bool failed = (ferror(fp) != 0);
+	if (fclose(fp) != 0) {
+		failed = true;
+	}
+	if (failed) {
+		cout << "DatasetCache: write " << tmpPath << " error!" << endl;
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	remove(path.c_str());
+	if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+		cout << "DatasetCache: can not replace " << path << endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Memory-mapped binary dataset file:
+//   header | eigen names | scene table | feature columns | label
+// Features are stored column by column, rows of a scene are contiguous and
+// every scene carries a stamp of its json files to detect changes. The header
+// carries a stamp of the labelling config, the labels are stale if it changed.
+class DatasetCache {
+public:
+	struct SceneInfo {
+		string name;
+		uint64_t stamp;				// 场景下所有 json 文件名、大小和修改时间的哈希，0 表示下次必须重新解析
+		uint64_t rowBegin;
+		uint64_t numOfRows;
+	};
+
+	DatasetCache();
+	~DatasetCache();
+
+	bool Open(const string path, uint64_t labelStamp);
+	void Close();
+
+	const vector<string> & EigenNames() const { return mEigenNames; }
+	size_t NumOfScenes() const { return mScenes.size(); }
+	const SceneInfo * FindScene(const string &name, uint64_t stamp) const;
+	void CopyRows(uint64_t rowBegin, uint64_t numOfRows, double *eigenSpace, double *label) const;
+
+	static bool Write(const string path, uint64_t labelStamp, const vector<string> &eigenNames, const vector<SceneInfo> &scenes,
+		const vector<double> &eigenSpace, const vector<double> &label);
+
+private:
+	struct FileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t numOfEigenElem;
+		uint64_t numOfRows;
+		uint64_t numOfScenes;
+		uint64_t columnsOffset;
+		uint64_t labelOffset;
+		uint64_t fileSize;
+		uint64_t labelStamp;		// 生成标签的参数的哈希
+	};
+
+	static const char * const FILE_MAGIC;
+	static const uint32_t FILE_VERSION = 2;
+
+	const char *mData;				// 映射的文件内容
+	size_t mSize;
+#ifdef _WIN32
+	void *mFileHandle;
+	void *mMappingHandle;
+#else
+	int mFileHandle;
+#endif
+
+	vector<string> mEigenNames;
+	vector<SceneInfo> mScenes;
+	map<string, size_t> mSceneIndex;
+	const double *mColumns;
+	const double *mLabel;
+	uint64_t mNumOfRows;
+
+	bool Map(const string path);
+	void Unmap();
+	bool ParseHeader(uint64_t labelStamp);
+};
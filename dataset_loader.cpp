@@ -0,0 +1,535 @@
+﻿#include <iostream>
+#include <algorithm>
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dataset_loader.h"
+#include "thread_pool.h"
+#include "dataset_cache.h"
+
+#include <time.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+#include <sys/stat.h>
+
+using namespace std;
+
+DatasetLoader::DatasetLoader()
+{
+	mDataMidPathCfg = "Data/";
+	mAnalysisMidPathCfg = "RelocalizationAnalysis/";
+	mCacheFileNameCfg = "Data.bin";
+	mRelocalizationDataMidPathCfg = "/RelocalizationData/";
+	mRefPoseFileNameCfg = "RefPose.json";
+	mPredictPoseFileNameCfg = "PredictPose.json";
+	mEigenVectorFileNameCfg = "EigenVector.json";
+	mMoveThresholdCfg = 5;
+	mRotateThresholdCfg = 5;
+	mPositionBatchSizeCfg = 64;
+}
+
+bool DatasetLoader::ReadFile(const string path, vector<char> &buffer)
+{
+	FILE *fp;
+	fopen_s(&fp, path.c_str(), "rb");
+	if (fp == nullptr) {
+		return false;
+	}
+
+	// Read the whole file and keep a terminating '\0' for the parser
+	size_t len = 0;
+	for (;;) {
+		if (buffer.size() < len + BUFSIZ + 1) {
+			buffer.resize(len + BUFSIZ + 1);
+		}
+		size_t readLen = fread(&buffer[len], 1, buffer.size() - len - 1, fp);
+		len += readLen;
+		if (readLen == 0) {
+			break;
+		}
+	}
+	buffer[len] = '\0';
+
+	bool ok = (ferror(fp) == 0);
+	fclose(fp);
+	return ok;
+}
+
+int DatasetLoader::ParseFlatJson(const char *json, JsonField *fields, int maxFields)
+{
+	// Parse a flat json object like {"x": 1, "y": 3, "phi": 2} in place,
+	// keys point into the json buffer and only numeric values are kept
+	int numOfFields = 0;
+	const char *p = json;
+
+	while (isspace((unsigned char)*p)) p++;
+	if (*p++ != '{') {
+		return -1;
+	}
+
+	for (;;) {
+		while (isspace((unsigned char)*p)) p++;
+		if (*p == '}') {
+			return numOfFields;
+		}
+
+		// Key
+		if (*p++ != '"') {
+			return -1;
+		}
+		const char *key = p;
+		while (*p && *p != '"') {
+			if (*p == '\\' && p[1]) p++;
+			p++;
+		}
+		if (*p != '"') {
+			return -1;
+		}
+		size_t keyLen = p - key;
+		p++;
+
+		while (isspace((unsigned char)*p)) p++;
+		if (*p++ != ':') {
+			return -1;
+		}
+		while (isspace((unsigned char)*p)) p++;
+
+		// Value
+		if (*p == '"') {
+			for (p++; *p && *p != '"'; p++) {
+				if (*p == '\\' && p[1]) p++;
+			}
+			if (*p++ != '"') {
+				return -1;
+			}
+		} else {
+			char *end;
+			double value = strtod(p, &end);
+			if (end == p) {
+				return -1;
+			}
+			p = end;
+
+			if (numOfFields == maxFields) {
+				return -1;
+			}
+			fields[numOfFields].key = key;
+			fields[numOfFields].keyLen = keyLen;
+			fields[numOfFields].value = value;
+			numOfFields++;
+		}
+
+		while (isspace((unsigned char)*p)) p++;
+		if (*p == ',') {
+			p++;
+		} else if (*p != '}') {
+			return -1;
+		}
+	}
+}
+
+const DatasetLoader::JsonField * DatasetLoader::FindField(const JsonField *fields, int numOfFields, const char *key, size_t keyLen)
+{
+	for (int i = 0; i < numOfFields; i++) {
+		if (fields[i].keyLen == keyLen && memcmp(fields[i].key, key, keyLen) == 0) {
+			return &fields[i];
+		}
+	}
+	return nullptr;
+}
+
+bool DatasetLoader::ReadJsonFile(const string path, vector<char> &buffer, JsonField *fields, int &numOfFields)
+{
+	if (!ReadFile(path, buffer)) {
+		cout << "DatasetLoader: can not read " << path << endl;
+		return false;
+	}
+
+	numOfFields = ParseFlatJson(&buffer[0], fields, MAX_JSON_FIELDS);
+	if (numOfFields < 0) {
+		cout << "DatasetLoader: invalid json file " << path << endl;
+		return false;
+	}
+	return true;
+}
+
+bool DatasetLoader::ListDirectory(const string path, vector<string> &names)
+{
+	// List sub directories, sorted by name so that the sample order is stable
+	names.clear();
+
+#ifdef _WIN32
+	struct _finddata_t fileInfo;
+	intptr_t handle = _findfirst((path + "*").c_str(), &fileInfo);
+	if (handle == -1) {
+		return false;
+	}
+	do {
+		if ((fileInfo.attrib & _A_SUBDIR) && strcmp(fileInfo.name, ".") != 0 && strcmp(fileInfo.name, "..") != 0) {
+			names.push_back(fileInfo.name);
+		}
+	} while (_findnext(handle, &fileInfo) == 0);
+	_findclose(handle);
+#else
+	DIR *dir = opendir(path.c_str());
+	if (dir == nullptr) {
+		return false;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != nullptr) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		// d_type saves a stat per entry where the file system reports it
+		struct stat fileStat;
+		if (entry->d_type == DT_DIR
+			|| (entry->d_type == DT_UNKNOWN && stat((path + entry->d_name).c_str(), &fileStat) == 0 && S_ISDIR(fileStat.st_mode))) {
+			names.push_back(entry->d_name);
+		}
+	}
+	closedir(dir);
+#endif
+
+	sort(names.begin(), names.end());
+	return true;
+}
+
+bool DatasetLoader::InitEigenNames(const string positionPath, RawDataset &dataset)
+{
+	// The names of eigen elements are taken from the first EigenVector.json in key order
+	JsonField fields[MAX_JSON_FIELDS];
+	int numOfFields = 0;
+	vector<char> buffer;
+
+	if (!ReadJsonFile(positionPath + mEigenVectorFileNameCfg, buffer, fields, numOfFields)) {
+		return false;
+	}
+
+	dataset.eigenNames.clear();
+	for (int i = 0; i < numOfFields; i++) {
+		dataset.eigenNames.push_back(string(fields[i].key, fields[i].keyLen));
+	}
+	return numOfFields > 0;
+}
+
+bool DatasetLoader::LoadPosition(const string positionPath, const vector<string> &eigenNames, vector<char> &buffer, PositionBatch &batch)
+{
+	JsonField fields[MAX_JSON_FIELDS];
+	int numOfFields = 0;
+	double refPose[3], predictPose[3];
+	const char * const poseKeys[3] = { "x", "y", "phi" };
+	size_t numOfEigenElem = eigenNames.size();
+
+	// Pose of reference and relocalization
+	if (!ReadJsonFile(positionPath + mRefPoseFileNameCfg, buffer, fields, numOfFields)) {
+		return false;
+	}
+	for (int i = 0; i < 3; i++) {
+		const JsonField *field = FindField(fields, numOfFields, poseKeys[i], strlen(poseKeys[i]));
+		if (field == nullptr) {
+			cout << "DatasetLoader: " << poseKeys[i] << " not found in " << positionPath << mRefPoseFileNameCfg << endl;
+			return false;
+		}
+		refPose[i] = field->value;
+	}
+
+	if (!ReadJsonFile(positionPath + mPredictPoseFileNameCfg, buffer, fields, numOfFields)) {
+		return false;
+	}
+	for (int i = 0; i < 3; i++) {
+		const JsonField *field = FindField(fields, numOfFields, poseKeys[i], strlen(poseKeys[i]));
+		if (field == nullptr) {
+			cout << "DatasetLoader: " << poseKeys[i] << " not found in " << positionPath << mPredictPoseFileNameCfg << endl;
+			return false;
+		}
+		predictPose[i] = field->value;
+	}
+
+	// Eigen vector in the order of eigen names
+	if (!ReadJsonFile(positionPath + mEigenVectorFileNameCfg, buffer, fields, numOfFields)) {
+		return false;
+	}
+
+	size_t rowStart = batch.eigenSpace.size();
+	batch.eigenSpace.resize(rowStart + numOfEigenElem);
+	for (size_t i = 0; i < numOfEigenElem; i++) {
+		const string &name = eigenNames[i];
+		const JsonField *field = FindField(fields, numOfFields, name.c_str(), name.size());
+		if (field == nullptr) {
+			cout << "DatasetLoader: " << name << " not found in " << positionPath << mEigenVectorFileNameCfg << endl;
+			batch.eigenSpace.resize(rowStart);
+			return false;
+		}
+		batch.eigenSpace[rowStart + i] = field->value;
+	}
+
+	if (fabs(refPose[0] - predictPose[0]) < mMoveThresholdCfg
+		&& fabs(refPose[1] - predictPose[1]) < mMoveThresholdCfg
+		&& fabs(refPose[2] - predictPose[2]) < mRotateThresholdCfg) {
+		batch.label.push_back(1);
+	} else {
+		batch.label.push_back(0);
+	}
+	return true;
+}
+
+void DatasetLoader::HashBytes(uint64_t &hash, const void *data, size_t len)
+{
+	// FNV-1a
+	const unsigned char *p = (const unsigned char *)data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+uint64_t DatasetLoader::StampPosition(const string positionPath, const string &positionName, int64_t now, bool &racy)
+{
+	// Stamp with name, size and modification time of json files, no need to read them.
+	// A file modified within the timestamp granularity of now may be rewritten without
+	// changing its time, such a position is racy and must be parsed again next time
+	const char * const fileNames[3] = { mRefPoseFileNameCfg, mPredictPoseFileNameCfg, mEigenVectorFileNameCfg };
+	int64_t fileInfo[3][2] = { { -1, -1 }, { -1, -1 }, { -1, -1 } };
+
+#ifdef _WIN32
+	// One directory enumeration returns size and 100ns write time of every file
+	WIN32_FIND_DATAA findData;
+	HANDLE handle = FindFirstFileExA((positionPath + "*.json").c_str(), FindExInfoBasic, &findData,
+		FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (handle != INVALID_HANDLE_VALUE) {
+		do {
+			for (int i = 0; i < 3; i++) {
+				if (_stricmp(findData.cFileName, fileNames[i]) == 0) {
+					fileInfo[i][0] = ((int64_t)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+					fileInfo[i][1] = ((int64_t)findData.ftLastWriteTime.dwHighDateTime << 32) | findData.ftLastWriteTime.dwLowDateTime;
+				}
+			}
+		} while (FindNextFileA(handle, &findData));
+		FindClose(handle);
+	}
+#else
+	for (int i = 0; i < 3; i++) {
+		struct stat fileStat;
+		if (stat((positionPath + fileNames[i]).c_str(), &fileStat) == 0) {
+#ifdef __APPLE__
+			int64_t nsec = (int64_t)fileStat.st_mtimespec.tv_nsec;
+#else
+			int64_t nsec = (int64_t)fileStat.st_mtim.tv_nsec;
+#endif
+			fileInfo[i][0] = (int64_t)fileStat.st_size;
+			fileInfo[i][1] = (int64_t)fileStat.st_mtime * 1000000000 + nsec;
+		}
+	}
+#endif
+
+	uint64_t stamp = 14695981039346656037ULL;
+	HashBytes(stamp, positionName.c_str(), positionName.size() + 1);
+	for (int i = 0; i < 3; i++) {
+		HashBytes(stamp, fileInfo[i], sizeof(fileInfo[i]));
+		if (fileInfo[i][1] >= now) {
+			racy = true;
+		}
+	}
+	return stamp;
+}
+
+uint64_t DatasetLoader::StampLabelConfig() const
+{
+	uint64_t stamp = 14695981039346656037ULL;
+	HashBytes(stamp, &mMoveThresholdCfg, sizeof(mMoveThresholdCfg));
+	HashBytes(stamp, &mRotateThresholdCfg, sizeof(mRotateThresholdCfg));
+	return stamp;
+}
+
+bool DatasetLoader::Load(const string workPath, RawDataset &dataset)
+{
+	string dataPath = workPath + mDataMidPathCfg;
+	string cachePath = workPath + mAnalysisMidPathCfg + mCacheFileNameCfg;
+	vector<string> scenes;
+
+	dataset.eigenNames.clear();
+	dataset.eigenSpace.clear();
+	dataset.label.clear();
+	dataset.changed = true;
+
+	if (!ListDirectory(dataPath, scenes)) {
+		cout << "DatasetLoader: can not open " << dataPath << endl;
+		return false;
+	}
+
+	// List positions of every scene, one task per scene
+	vector<SceneEntry> sceneEntries(scenes.size());
+	{
+		ThreadPool::TaskGroup group(THREADPOOL);
+		for (size_t i = 0; i < scenes.size(); i++) {
+			group.Run([&, i]() {
+				SceneEntry &entry = sceneEntries[i];
+				string relocalizationDataPath = dataPath + scenes[i] + mRelocalizationDataMidPathCfg;
+				if (!ListDirectory(relocalizationDataPath, entry.positions)) {
+					cout << "DatasetLoader: can not open " << relocalizationDataPath << endl;
+				}
+				entry.positionStamps.resize(entry.positions.size());
+			});
+		}
+		group.Wait();
+	}
+
+	// Stamp positions in batches across scenes, so one large scene does not run alone.
+	// Times within two seconds of now count as racy, that covers coarse file systems
+	vector<pair<size_t, size_t> > positionRefs;
+	for (size_t i = 0; i < scenes.size(); i++) {
+		for (size_t j = 0; j < sceneEntries[i].positions.size(); j++) {
+			positionRefs.push_back(make_pair(i, j));
+		}
+	}
+	vector<char> positionRacy(positionRefs.size(), 0);
+#ifdef _WIN32
+	FILETIME fileTime;
+	GetSystemTimeAsFileTime(&fileTime);
+	int64_t racyTime = (((int64_t)fileTime.dwHighDateTime << 32) | fileTime.dwLowDateTime) - 2 * 10000000LL;
+#else
+	int64_t racyTime = ((int64_t)time(NULL) - 2) * 1000000000;
+#endif
+
+	THREADPOOL->ParallelFor(0, positionRefs.size(), mPositionBatchSizeCfg, [&](size_t refBegin, size_t refEnd) {
+		for (size_t r = refBegin; r < refEnd; r++) {
+			SceneEntry &entry = sceneEntries[positionRefs[r].first];
+			const string &position = entry.positions[positionRefs[r].second];
+			string positionPath = dataPath + scenes[positionRefs[r].first] + mRelocalizationDataMidPathCfg + position + "/";
+			bool racy = false;
+			entry.positionStamps[positionRefs[r].second] = StampPosition(positionPath, position, racyTime, racy);
+			positionRacy[r] = racy;
+		}
+	});
+
+	for (size_t r = 0, i = 0; i < scenes.size(); i++) {
+		SceneEntry &entry = sceneEntries[i];
+		entry.stamp = 14695981039346656037ULL;
+		entry.racy = false;
+		for (size_t j = 0; j < entry.positions.size(); j++, r++) {
+			HashBytes(entry.stamp, &entry.positionStamps[j], sizeof(uint64_t));
+			entry.racy = entry.racy || positionRacy[r];
+		}
+	}
+
+	// Unchanged scenes are copied from the binary cache, the others are parsed
+	uint64_t labelStamp = StampLabelConfig();
+	DatasetCache cache;
+	bool cacheValid = cache.Open(cachePath, labelStamp);
+	bool changed = !cacheValid || cache.NumOfScenes() != scenes.size();
+	if (cacheValid) {
+		dataset.eigenNames = cache.EigenNames();
+	}
+
+	// Batches never cross scenes, so rows of a scene stay countable
+	vector<string> positionPaths;
+	vector<pair<size_t, size_t> > batchRanges;
+	for (size_t i = 0; i < scenes.size(); i++) {
+		SceneEntry &entry = sceneEntries[i];
+		entry.cached = (cacheValid && !entry.racy) ? cache.FindScene(scenes[i], entry.stamp) : nullptr;
+		entry.firstBatch = batchRanges.size();
+		if (entry.cached) {
+			continue;
+		}
+
+		changed = true;
+		string relocalizationDataPath = dataPath + scenes[i] + mRelocalizationDataMidPathCfg;
+		size_t sceneBegin = positionPaths.size();
+		for (size_t j = 0; j < entry.positions.size(); j++) {
+			positionPaths.push_back(relocalizationDataPath + entry.positions[j] + "/");
+		}
+		for (size_t begin = sceneBegin; begin < positionPaths.size(); begin += mPositionBatchSizeCfg) {
+			batchRanges.push_back(make_pair(begin, min(begin + mPositionBatchSizeCfg, positionPaths.size())));
+		}
+	}
+	for (size_t i = 0; i < scenes.size(); i++) {
+		sceneEntries[i].endBatch = (i + 1 < scenes.size()) ? sceneEntries[i + 1].firstBatch : batchRanges.size();
+	}
+
+	// Eigen names must be known before parsing in parallel
+	for (size_t i = 0; i < positionPaths.size() && dataset.eigenNames.empty(); i++) {
+		InitEigenNames(positionPaths[i], dataset);
+	}
+
+	// Parse changed positions in batches, each batch is a task of the work-stealing pool
+	size_t numOfBatches = batchRanges.size();
+	vector<PositionBatch> batches(numOfBatches);
+
+	THREADPOOL->ParallelFor(0, numOfBatches, 1, [&](size_t batchBegin, size_t batchEnd) {
+		vector<char> buffer;
+		for (size_t b = batchBegin; b < batchEnd; b++) {
+			for (size_t i = batchRanges[b].first; i < batchRanges[b].second; i++) {
+				if (!LoadPosition(positionPaths[i], dataset.eigenNames, buffer, batches[b])) {
+					cout << "DatasetLoader: skip " << positionPaths[i] << endl;
+				}
+			}
+		}
+	});
+
+	// Merge scenes into the contiguous eigen space in scene order
+	size_t numOfEigenElem = dataset.eigenNames.size();
+	vector<DatasetCache::SceneInfo> sceneInfos(scenes.size());
+	uint64_t numOfRows = 0;
+
+	for (size_t i = 0; i < scenes.size(); i++) {
+		SceneEntry &entry = sceneEntries[i];
+		sceneInfos[i].name = scenes[i];
+		sceneInfos[i].stamp = entry.racy ? 0 : entry.stamp;
+		sceneInfos[i].rowBegin = numOfRows;
+		if (entry.cached) {
+			sceneInfos[i].numOfRows = entry.cached->numOfRows;
+		} else {
+			sceneInfos[i].numOfRows = 0;
+			for (size_t b = entry.firstBatch; b < entry.endBatch; b++) {
+				sceneInfos[i].numOfRows += batches[b].label.size();
+			}
+		}
+		numOfRows += sceneInfos[i].numOfRows;
+	}
+
+	dataset.eigenSpace.resize(numOfRows * numOfEigenElem);
+	dataset.label.resize(numOfRows);
+
+	THREADPOOL->ParallelFor(0, scenes.size(), 1, [&](size_t sceneBegin, size_t sceneEnd) {
+		for (size_t i = sceneBegin; i < sceneEnd; i++) {
+			SceneEntry &entry = sceneEntries[i];
+			uint64_t row = sceneInfos[i].rowBegin;
+			if (entry.cached) {
+				// An empty scene has no rows to copy and the dataset may have none at all
+				if (entry.cached->numOfRows > 0) {
+					cache.CopyRows(entry.cached->rowBegin, entry.cached->numOfRows, dataset.eigenSpace.data() + row * numOfEigenElem, dataset.label.data() + row);
+				}
+				continue;
+			}
+			for (size_t b = entry.firstBatch; b < entry.endBatch; b++) {
+				if (!batches[b].label.empty()) {
+					memcpy(&dataset.eigenSpace[row * numOfEigenElem], &batches[b].eigenSpace[0], batches[b].eigenSpace.size() * sizeof(double));
+					memcpy(&dataset.label[row], &batches[b].label[0], batches[b].label.size() * sizeof(double));
+					row += batches[b].label.size();
+				}
+				vector<double>().swap(batches[b].eigenSpace);
+				vector<double>().swap(batches[b].label);
+			}
+		}
+	});
+
+	// The mapping must be released before the cache file is replaced
+	cache.Close();
+	dataset.changed = changed;
+	if (changed && !dataset.label.empty()) {
+		DatasetCache::Write(cachePath, labelStamp, dataset.eigenNames, sceneInfos, dataset.eigenSpace, dataset.label);
+	}
+
+	if (dataset.label.empty()) {
+		cout << "DatasetLoader: no sample found in " << dataPath << endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "dataset_cache.h"
+
+using namespace std;
+
+// Samples loaded from Data/<Scene>/RelocalizationData/<Position>/
+struct RawDataset {
+	vector<string> eigenNames;
+	vector<double> eigenSpace;		// 特征空间，按行存储，每行 eigenNames.size() 个特征
+	vector<double> label;			// 重定位是否成功，1 成功，0 失败
+	bool changed;					// 与上次缓存的数据集相比是否有变化
+};
+
+class DatasetLoader {
+public:
+	DatasetLoader();
+
+	bool Load(const string workPath, RawDataset &dataset);
+
+	/* Configure parameters */
+private:
+	const char * mDataMidPathCfg;
+	const char * mAnalysisMidPathCfg;
+	const char * mCacheFileNameCfg;
+	const char * mRelocalizationDataMidPathCfg;
+	const char * mRefPoseFileNameCfg;
+	const char * mPredictPoseFileNameCfg;
+	const char * mEigenVectorFileNameCfg;
+	double mMoveThresholdCfg;
+	double mRotateThresholdCfg;
+
+	/* Json parse */
+private:
+	struct JsonField {
+		const char *key;
+		size_t keyLen;
+		double value;
+	};
+
+	static const int MAX_JSON_FIELDS = 32;
+
+	static bool ReadFile(const string path, vector<char> &buffer);
+	static int ParseFlatJson(const char *json, JsonField *fields, int maxFields);
+	static const JsonField * FindField(const JsonField *fields, int numOfFields, const char *key, size_t keyLen);
+	static bool ReadJsonFile(const string path, vector<char> &buffer, JsonField *fields, int &numOfFields);
+
+	/* Directory walk */
+private:
+	// Samples parsed by one task, merged in order afterwards
+	struct PositionBatch {
+		vector<double> eigenSpace;
+		vector<double> label;
+	};
+
+	struct SceneEntry {
+		vector<string> positions;
+		vector<uint64_t> positionStamps;
+		uint64_t stamp;
+		bool racy;								// 有文件刚被修改，时间戳可能还会不变地再次修改
+		const DatasetCache::SceneInfo *cached;	// 缓存中未变化的场景，否则为空
+		size_t firstBatch;
+		size_t endBatch;
+	};
+
+	size_t mPositionBatchSizeCfg;
+
+	static bool ListDirectory(const string path, vector<string> &names);
+	static void HashBytes(uint64_t &hash, const void *data, size_t len);
+	uint64_t StampPosition(const string positionPath, const string &positionName, int64_t now, bool &racy);
+	uint64_t StampLabelConfig() const;
+	bool InitEigenNames(const string positionPath, RawDataset &dataset);
+	bool LoadPosition(const string positionPath, const vector<string> &eigenNames, vector<char> &buffer, PositionBatch &batch);
+};
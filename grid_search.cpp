@@ -0,0 +1,333 @@
+﻿#include <iostream>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include "grid_search.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+static void PrintNothing(const char *) {}
+
+GridSearch::GridSearch()
+{
+	mCMinExpCfg = -4;
+	mCMaxExpCfg = 5;
+	mNumOfCCfg = 10;
+	mGammaMinExpCfg = -9;
+	mGammaMaxExpCfg = 3;
+	mNumOfGammaCfg = 13;
+	mNumOfSplitsCfg = 10;
+	mTestSizeCfg = 0.2;
+	mRandomStateCfg = 1;
+	mKernelMatrixBudgetCfg = 1024;
+	mHalvingFactorCfg = 3;
+	mHalvingMinSamplesCfg = 30;
+	mHalvingMinSplitsCfg = 3;
+	mBestIndex = 0;
+}
+
+void GridSearch::LogSpace(double minExp, double maxExp, size_t num, vector<double> &range)
+{
+	range.resize(num);
+	for (size_t i = 0; i < num; i++) {
+		double power = (num > 1) ? minExp + (maxExp - minExp) * i / (num - 1) : minExp;
+		range[i] = pow(10.0, power);
+	}
+}
+
+void GridSearch::ShuffleSplit(size_t numOfSamples)
+{
+	// Same sizes as sklearn ShuffleSplit: ceil(test_size * n) test samples, the rest for training
+	size_t numOfTest = (size_t)ceil(mTestSizeCfg * numOfSamples);
+	mt19937 rng(mRandomStateCfg);
+	vector<int> perm(numOfSamples);
+
+	mSplits.resize(mNumOfSplitsCfg);
+	for (size_t s = 0; s < mNumOfSplitsCfg; s++) {
+		for (size_t i = 0; i < numOfSamples; i++) {
+			perm[i] = (int)i;
+		}
+		for (size_t i = numOfSamples; i > 1; i--) {
+			size_t j = uniform_int_distribution<size_t>(0, i - 1)(rng);
+			swap(perm[i - 1], perm[j]);
+		}
+		mSplits[s].test.assign(perm.begin(), perm.begin() + numOfTest);
+		mSplits[s].train.assign(perm.begin() + numOfTest, perm.end());
+	}
+}
+
+double GridSearch::Score(const svm_model *model, const svm_problem &prob, const Split &split) const
+{
+	// A weighted row stands for that many samples
+	double correct = 0, total = 0;
+	for (size_t i = 0; i < split.test.size(); i++) {
+		double weight = prob.W ? prob.W[split.test[i]] : 1;
+		if (svm_predict(model, prob.x[split.test[i]]) == prob.y[split.test[i]]) {
+			correct += weight;
+		}
+		total += weight;
+	}
+	return correct / total;
+}
+
+void GridSearch::FitSplit(const svm_problem &prob, const svm_parameter &param, const Split &split, size_t numOfTrain,
+	const vector<double> &CRange, double kernelMatrixBudget, double *scores) const
+{
+	// Rows are shared with prob, only the pointer arrays are per job.
+	// The training rows are already shuffled, so a prefix of them is a random subsample
+	vector<svm_node *> x(numOfTrain);
+	vector<double> y(numOfTrain);
+	vector<double> W(prob.W ? numOfTrain : 0);
+	for (size_t i = 0; i < numOfTrain; i++) {
+		x[i] = prob.x[split.train[i]];
+		y[i] = prob.y[split.train[i]];
+		if (prob.W) {
+			W[i] = prob.W[split.train[i]];
+		}
+	}
+
+	svm_problem subProb;
+	memset(&subProb, 0, sizeof(subProb));
+	subProb.l = (int)x.size();
+	subProb.x = x.data();
+	subProb.y = y.data();
+	subProb.W = prob.W ? W.data() : NULL;
+
+	// Every C of this gamma reads the same kernel values, compute them once if they fit
+	svm_parameter fitParam = param;
+	svm_kernel_matrix *kernelMatrix = nullptr;
+	if (svm_kernel_matrix_size(subProb.l) <= kernelMatrixBudget) {
+		kernelMatrix = svm_kernel_matrix_create(&subProb, &fitParam);
+		fitParam.kernel_matrix = kernelMatrix;
+	}
+
+	// C grows along the range, each fit is warm started from the previous one
+	vector<svm_model *> models(CRange.size());
+	svm_train_path(&subProb, &fitParam, (int)CRange.size(), CRange.data(), models.data());
+	for (size_t c = 0; c < CRange.size(); c++) {
+		scores[c] = Score(models[c], prob, split);
+		svm_free_and_destroy_model(&models[c]);
+	}
+
+	svm_kernel_matrix_free(kernelMatrix);
+}
+
+void GridSearch::ScoreRound(const svm_problem &prob, const svm_parameter &jobParam, const vector<size_t> &points,
+	int round, size_t numOfTrain, size_t numOfSplits)
+{
+	// Group the points by gamma, every group is one warm started path of C per split
+	size_t numOfGamma = mGammaRange.size();
+	vector<vector<size_t>> CIndices(numOfGamma);
+	for (size_t i = 0; i < points.size(); i++) {
+		CIndices[points[i] % numOfGamma].push_back(points[i] / numOfGamma);
+	}
+
+	vector<size_t> gammaIndices;
+	for (size_t g = 0; g < numOfGamma; g++) {
+		if (!CIndices[g].empty()) {
+			sort(CIndices[g].begin(), CIndices[g].end());
+			gammaIndices.push_back(g);
+		}
+	}
+
+	// One job per (gamma, split), scores are stored as [C][gamma][split]
+	size_t numOfJobs = gammaIndices.size() * numOfSplits;
+	double kernelMatrixBudget = mKernelMatrixBudgetCfg / THREADPOOL->NumOfThreads();
+	vector<double> splitScores(mScores.size() * numOfSplits);
+
+	THREADPOOL->ParallelFor(0, numOfJobs, 1, [&](size_t jobBegin, size_t jobEnd) {
+		vector<double> CRange;
+		vector<double> scores;
+		for (size_t job = jobBegin; job < jobEnd; job++) {
+			size_t g = gammaIndices[job / numOfSplits];
+			size_t s = job % numOfSplits;
+			const vector<size_t> &cs = CIndices[g];
+			CRange.resize(cs.size());
+			scores.resize(cs.size());
+			for (size_t i = 0; i < cs.size(); i++) {
+				CRange[i] = mCRange[cs[i]];
+			}
+
+			svm_parameter fitParam = jobParam;
+			fitParam.gamma = mGammaRange[g];
+			FitSplit(prob, fitParam, mSplits[s], numOfTrain, CRange, kernelMatrixBudget, scores.data());
+			for (size_t i = 0; i < cs.size(); i++) {
+				splitScores[(cs[i] * numOfGamma + g) * numOfSplits + s] = scores[i];
+			}
+		}
+	});
+
+	for (size_t i = 0; i < points.size(); i++) {
+		size_t p = points[i];
+		const double *scores = &splitScores[p * numOfSplits];
+		double sum = 0;
+		for (size_t s = 0; s < numOfSplits; s++) {
+			sum += scores[s];
+		}
+		double mean = sum / numOfSplits;
+		double var = 0;
+		for (size_t s = 0; s < numOfSplits; s++) {
+			var += (scores[s] - mean) * (scores[s] - mean);
+		}
+		mScores[p].meanScore = mean;
+		mScores[p].stdScore = sqrt(var / numOfSplits);
+		mScores[p].round = round;
+		mScores[p].numOfSamples = numOfTrain;
+	}
+}
+
+void GridSearch::RankScores()
+{
+	// Rank like sklearn ("min" method), points of a later round rank before those
+	// dropped earlier. The best is the first point with rank 1
+	mBestIndex = 0;
+	for (size_t p = 0; p < mScores.size(); p++) {
+		int rank = 1;
+		for (size_t q = 0; q < mScores.size(); q++) {
+			if (mScores[q].round > mScores[p].round ||
+				(mScores[q].round == mScores[p].round && mScores[q].meanScore > mScores[p].meanScore)) {
+				rank++;
+			}
+		}
+		mScores[p].rank = rank;
+		if (rank == 1 && mScores[mBestIndex].rank != 1) {
+			mBestIndex = p;
+		}
+	}
+}
+
+bool GridSearch::Prepare(const svm_problem &prob, const svm_parameter &param, svm_parameter &jobParam)
+{
+	if (prob.l <= 1) {
+		cout << "GridSearch::Prepare(): not enough samples!" << endl;
+		return false;
+	}
+
+	LogSpace(mCMinExpCfg, mCMaxExpCfg, mNumOfCCfg, mCRange);
+	LogSpace(mGammaMinExpCfg, mGammaMaxExpCfg, mNumOfGammaCfg, mGammaRange);
+	ShuffleSplit(prob.l);
+
+	// Grid order of sklearn ParameterGrid: C outer, gamma inner
+	mScores.resize(mCRange.size() * mGammaRange.size());
+	for (size_t c = 0; c < mCRange.size(); c++) {
+		for (size_t g = 0; g < mGammaRange.size(); g++) {
+			GridSearchScore &score = mScores[c * mGammaRange.size() + g];
+			score.C = mCRange[c];
+			score.gamma = mGammaRange[g];
+			score.meanScore = 0;
+			score.stdScore = 0;
+			score.rank = 0;
+			score.round = 0;
+			score.numOfSamples = 0;
+		}
+	}
+
+	// The pool runs one fit per thread, so every fit gets its share of the cache
+	jobParam = param;
+	jobParam.kernel_type = RBF;
+	jobParam.probability = 0;
+	jobParam.nr_thread = 1;
+	jobParam.cache_size = param.cache_size / THREADPOOL->NumOfThreads();
+	jobParam.C = mCRange[0];
+	jobParam.gamma = mGammaRange[0];
+
+	const char *errorMsg = svm_check_parameter(&prob, &jobParam);
+	if (errorMsg) {
+		cout << "GridSearch::Prepare(): check svm parameter error for " << errorMsg << endl;
+		return false;
+	}
+	return true;
+}
+
+bool GridSearch::Run(const svm_problem &prob, const svm_parameter &param)
+{
+	svm_parameter jobParam;
+	if (!Prepare(prob, param, jobParam)) {
+		return false;
+	}
+
+	vector<size_t> points(mScores.size());
+	for (size_t p = 0; p < points.size(); p++) {
+		points[p] = p;
+	}
+
+	svm_set_print_string_function(&PrintNothing);
+	ScoreRound(prob, jobParam, points, 0, mSplits[0].train.size(), mSplits.size());
+	svm_set_print_string_function(NULL);
+
+	RankScores();
+	return true;
+}
+
+bool GridSearch::RunHalving(const svm_problem &prob, const svm_parameter &param)
+{
+	svm_parameter jobParam;
+	if (!Prepare(prob, param, jobParam)) {
+		return false;
+	}
+
+	// Enough rounds to halve the grid down to a few points, as long as the first
+	// round still has mHalvingMinSamplesCfg rows. The last round uses every row
+	size_t factor = max(mHalvingFactorCfg, (size_t)2);
+	size_t maxSamples = mSplits[0].train.size();
+	size_t numOfRounds = 1;
+	for (size_t n = mScores.size(), samples = maxSamples; n >= factor && samples / factor >= mHalvingMinSamplesCfg; n /= factor, samples /= factor) {
+		numOfRounds++;
+	}
+
+	vector<size_t> points(mScores.size());
+	for (size_t p = 0; p < points.size(); p++) {
+		points[p] = p;
+	}
+
+	// Rows and splits both grow by factor each round, round 0 starts at maxSamples / factor^(numOfRounds - 1)
+	size_t numOfSamples = maxSamples;
+	for (size_t round = 1; round < numOfRounds; round++) {
+		numOfSamples /= factor;
+	}
+	size_t numOfSplits = min(max(mHalvingMinSplitsCfg, (size_t)1), mSplits.size());
+
+	svm_set_print_string_function(&PrintNothing);
+	for (size_t round = 0; round < numOfRounds; round++) {
+		if (round + 1 == numOfRounds) {
+			numOfSamples = maxSamples;
+			numOfSplits = mSplits.size();
+		}
+		ScoreRound(prob, jobParam, points, (int)round, numOfSamples, numOfSplits);
+
+		if (round + 1 < numOfRounds) {
+			// Keep the best 1/factor, ties keep the earlier point
+			stable_sort(points.begin(), points.end(), [&](size_t a, size_t b) {
+				return mScores[a].meanScore > mScores[b].meanScore;
+			});
+			points.resize((points.size() + factor - 1) / factor);
+			numOfSamples *= factor;
+			numOfSplits = min(numOfSplits * factor, mSplits.size());
+		}
+	}
+	svm_set_print_string_function(NULL);
+
+	RankScores();
+	return true;
+}
+
+bool GridSearch::SaveScores(const string path) const
+{
+	FILE *fp;
+	fopen_s(&fp, path.c_str(), "w");
+	if (fp == nullptr) {
+		cout << "GridSearch::SaveScores(): can not open " << path << endl;
+		return false;
+	}
+
+	fprintf(fp, "C,gamma,mean_test_score,std_test_score,rank_test_score,iter,n_resources\n");
+	for (size_t p = 0; p < mScores.size(); p++) {
+		fprintf(fp, "%g,%g,%.6f,%.6f,%d,%d,%zu\n", mScores[p].C, mScores[p].gamma,
+			mScores[p].meanScore, mScores[p].stdScore, mScores[p].rank, mScores[p].round, mScores[p].numOfSamples);
+	}
+	fclose(fp);
+	return true;
+}
@@ -0,0 +1,81 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "svm/svm.h"
+
+using namespace std;
+
+// Mean cross validation score of one (C, gamma) point
+struct GridSearchScore {
+	double C;
+	double gamma;
+	double meanScore;			// 各次划分测试集准确率的均值
+	double stdScore;
+	int rank;					// 1 为最优，分数相同的点排名相同
+	int round;					// 最后参与的轮次，逐轮减半搜索中轮次越靠后排名越靠前
+	size_t numOfSamples;		// 最后一轮每次划分使用的训练样本数
+};
+
+// Exhaustive search of C and gamma for an RBF C-SVC, equivalent to sklearn
+// GridSearchCV over logspace grids with ShuffleSplit cross validation.
+// Every (gamma, split) is a job on the thread pool that fits all C values as
+// one warm started path against a kernel matrix of the split's training rows.
+//
+// RunHalving() is the successive halving variant, like sklearn
+// HalvingGridSearchCV: every point is first scored on a small prefix of each
+// split's training rows and a few splits, only the best 1/factor go on to the
+// next round with factor times the rows, and the last round scores the
+// survivors exactly as Run() would.
+class GridSearch {
+public:
+	GridSearch();
+
+	// param gives every svm parameter but C and gamma
+	bool Run(const svm_problem &prob, const svm_parameter &param);
+	bool RunHalving(const svm_problem &prob, const svm_parameter &param);
+	bool SaveScores(const string path) const;
+
+	const vector<GridSearchScore> & Scores() const { return mScores; }
+	const GridSearchScore & Best() const { return mScores[mBestIndex]; }
+
+	/* Configure parameters */
+private:
+	double mCMinExpCfg;
+	double mCMaxExpCfg;
+	size_t mNumOfCCfg;
+	double mGammaMinExpCfg;
+	double mGammaMaxExpCfg;
+	size_t mNumOfGammaCfg;
+	size_t mNumOfSplitsCfg;
+	double mTestSizeCfg;
+	uint32_t mRandomStateCfg;
+	double mKernelMatrixBudgetCfg;		// MB，所有并行任务的核矩阵总预算
+	size_t mHalvingFactorCfg;			// 每轮保留 1/factor 的点，训练样本数乘以 factor
+	size_t mHalvingMinSamplesCfg;		// 第一轮每次划分的最少训练样本数
+	size_t mHalvingMinSplitsCfg;		// 第一轮使用的划分数
+
+	/* Search */
+private:
+	struct Split {
+		vector<int> train;
+		vector<int> test;
+	};
+
+	vector<double> mCRange;
+	vector<double> mGammaRange;
+	vector<Split> mSplits;
+	vector<GridSearchScore> mScores;
+	size_t mBestIndex;
+
+	static void LogSpace(double minExp, double maxExp, size_t num, vector<double> &range);
+	void ShuffleSplit(size_t numOfSamples);
+	bool Prepare(const svm_problem &prob, const svm_parameter &param, svm_parameter &jobParam);
+	double Score(const svm_model *model, const svm_problem &prob, const Split &split) const;
+	void FitSplit(const svm_problem &prob, const svm_parameter &param, const Split &split, size_t numOfTrain,
+		const vector<double> &CRange, double kernelMatrixBudget, double *scores) const;
+	void ScoreRound(const svm_problem &prob, const svm_parameter &jobParam, const vector<size_t> &points,
+		int round, size_t numOfTrain, size_t numOfSplits);
+	void RankScores();
+};
@@ -1,6 +1,7 @@
 ﻿#include <iostream>
 #include "Python.h"
 #include "svm/svm.h"
+#include "svm/svm_parallel.h"
 #include "pose_judger.h"
 
 using namespace std;
@@ -18,9 +19,16 @@ int main(int argc, char **argv)
 		workPath = argv[1];
 	}
 	
+	// Before the first parallel loop creates the thread pool
+	svm_setup_thread_pool();
+
 	string judgerModelPath = workPath + "RelocalizationAnalysis/judger_model.h";
+	string judgerPredictorPath = workPath + "RelocalizationAnalysis/judger_predictor.h";
 	string relocalizationAnalysisPath = workPath + "RelocalizationAnalysis/";
 	
+	// Load dataset from json files
+	RELOCALIZATIONJUDGER->LoadRawData(workPath);
+
 	// Train, optimize and get the parameters
 	RELOCALIZATIONJUDGER->RunPythonModule(workPath);
 	
@@ -29,6 +37,9 @@ int main(int argc, char **argv)
 	
 	// Save judger model as .h file
 	RELOCALIZATIONJUDGER->SaveJudgerModel(judgerModelPath);
+
+	// Save header only predictor with the model folded into constants
+	RELOCALIZATIONJUDGER->SaveJudgerPredictor(judgerPredictorPath);
 	
 	// Analysis and export result
 	RELOCALIZATIONJUDGER->PredictAndAnalysis(relocalizationAnalysisPath);
@@ -1,37 +1,47 @@
 ﻿#include <iostream>
+#include <new>
+#include <unordered_map>
 #include "Python.h"
 #include "svm/svm.h"
+#include "svm/svm_memory.h"
 #include "pose_judger.h"
+#include "dataset_loader.h"
 
 using namespace std;
 
-#define SVM_PARAMS_NUM		5
+#define SVM_PARAMS_NUM		3
 
 RelocalizationJudger * RelocalizationJudger::mInstance = nullptr;
 mutex RelocalizationJudger::mInstanceMutex;
+atomic<uint64_t> RelocalizationJudger::mModelGeneration(0);
 
 RelocalizationJudger::RelocalizationJudger()
 {
 	mPyFilePathCfg = "sys.path.append('./')";
 	mPyFileNameCfg = "analysis_module";
+	mAnalysisMidPathCfg = "RelocalizationAnalysis/";
 	mPredictDataFileNameCfg = "PredictData.csv";
+	mGridSearchScoreFileNameCfg = "GridSearchScore.csv";
 	mAnalysisResultFileNameCfg = "AnalysisResult.txt";
 	mSetPyPathFunCfg = "SetWorkPath";
+	mSetDataFunCfg = "SetData";
 	mRunPyModuleFunCfg = "Run";
-	mGetEigenNamesFunCfg = "GetEigenNames";
-	mGetEigenSpaceFunCfg = "GetEigenSpace";
-	mGetLableFunCfg = "GetLable";
+	mAnalyzeFunCfg = "Analyze";
 	mGetTrainEigenFunCfg = "GetTrainEigenSpace";
-	mGetTrainEigenNormFunCfg = "GetTrainEigenSpaceNormalized";
 	mGetTrainLableFunCfg = "GetTrainLable";
 	mGetTestEigenFunCfg = "GetTestEigenSpace";
-	mGetTestEigenNormFunCfg = "GetTestEigenSpaceNormalized";
 	mGetTestLableFunCfg = "GetTestLable";
 	mGetMeanAndStdFunCfg = "GetTrainMeanAndStdInNormalization";
 	mGetRatioFunCfg = "GetRatioInNormalization";
 	mGetSVCParamFunCfg = "GetSVCParams";
+	mHalvingSearchCfg = false;
+	mCompareFloatStorageCfg = false;
+	mDedupTrainSamplesCfg = false;
+	mReducedNumOfSVCfg = 0;
+	mReducedMaxLossCfg = 0.1;
 
 	mNumOfEigenElem = 0;
+	mRawDataChanged = true;
 	mRawEigenSpaceLen = 0;
 	mTrainEigenSpaceNormLen = 0;
 	mTestEigenSpaceNormLen = 0;
@@ -42,6 +52,18 @@ RelocalizationJudger::RelocalizationJudger()
 	mRawEigenSpace = nullptr;
 	mTrainEigenSpace = nullptr;
 	mTestEigenSpace = nullptr;
+	mRawEigenSpaceArena = nullptr;
+	mTrainEigenSpaceArena = nullptr;
+	mTestEigenSpaceArena = nullptr;
+
+	memset(&mSVMParam, 0, sizeof(mSVMParam));
+	memset(&mTrainSVMProb, 0, sizeof(mTrainSVMProb));
+	memset(&mTestSVMProb, 0, sizeof(mTestSVMProb));
+	mTrainSVMProbArena = nullptr;
+	mTestSVMProbArena = nullptr;
+	mJudgerModel.svmModel = nullptr;
+	mJudgerModel.fullSvmModel = nullptr;
+	mJudgerModel.generation = 0;
 }
 
 RelocalizationJudger::~RelocalizationJudger()
@@ -51,6 +73,7 @@ RelocalizationJudger::~RelocalizationJudger()
 	DestoryTestSVMProb();
 	svm_destroy_param(&mSVMParam);
 	svm_free_and_destroy_model(&mJudgerModel.svmModel);
+	svm_free_and_destroy_model(&mJudgerModel.fullSvmModel);
 }
 
 RelocalizationJudger * RelocalizationJudger::Instance()
@@ -77,60 +100,65 @@ void RelocalizationJudger::ReleaseInstance()
 	}
 }
 
-void RelocalizationJudger::DestoryRawData()
+svm_node ** RelocalizationJudger::NewNodeMatrix(size_t numOfRows, size_t rowSize, svm_node *&arena)
 {
-	if (mRawLabel) {
-		delete[] mRawLabel;
+	// All rows share one arena block, the row pointers point into it.
+	// The block may be backed by huge pages, see SVM_HUGEPAGES in svm_memory.h
+	arena = (svm_node *)svm_alloc_large(sizeof(svm_node) * numOfRows * rowSize);
+	if (arena == nullptr && numOfRows * rowSize > 0) {
+		// Fail like the new[] it replaced instead of filling a null arena
+		throw bad_alloc();
 	}
-	
-	if (mRawEigenSpace) {
-		for (size_t i = 0; i < mRawEigenSpaceLen; i++) {
-			delete[] mRawEigenSpace[i];
-		}
-		delete[] mRawEigenSpace;
+	svm_node **rows = new svm_node *[numOfRows];
+	for (size_t i = 0; i < numOfRows; i++) {
+		rows[i] = arena + i * rowSize;
 	}
+	return rows;
+}
 
-	if (mTrainEigenSpace) {
-		for (size_t i = 0; i < mTrainEigenSpaceLen; i++) {
-			delete[] mTrainEigenSpace[i];
-		}
-		delete[] mTrainEigenSpace;
-	}
+void RelocalizationJudger::DeleteNodeMatrix(svm_node **&rows, svm_node *&arena)
+{
+	svm_free_large(arena);
+	delete[] rows;
+	arena = nullptr;
+	rows = nullptr;
+}
 
-	if (mTestEigenSpace) {
-		for (size_t i = 0; i < mTestEigenSpaceLen; i++) {
-			delete[] mTestEigenSpace[i];
-		}
-		delete[] mTestEigenSpace;
+void RelocalizationJudger::DestoryRawData()
+{
+	if (mRawLabel) {
+		delete[] mRawLabel;
+		mRawLabel = nullptr;
 	}
+
+	DeleteNodeMatrix(mRawEigenSpace, mRawEigenSpaceArena);
+	DeleteNodeMatrix(mTrainEigenSpace, mTrainEigenSpaceArena);
+	DeleteNodeMatrix(mTestEigenSpace, mTestEigenSpaceArena);
 }
 
 void RelocalizationJudger::DestoryTrainSVMProb()
 {
 	if (mTrainSVMProb.y) {
 		delete[] mTrainSVMProb.y;
+		mTrainSVMProb.y = nullptr;
 	}
-	
-	if (mTrainSVMProb.x) {
-		for (size_t i = 0; i < mTrainEigenSpaceNormLen; i++) {
-			delete[] mTrainSVMProb.x[i];
-		}
-		delete[] mTrainSVMProb.x;
+
+	if (mTrainSVMProb.W) {
+		delete[] mTrainSVMProb.W;
+		mTrainSVMProb.W = nullptr;
 	}
+
+	DeleteNodeMatrix(mTrainSVMProb.x, mTrainSVMProbArena);
 }
 
 void RelocalizationJudger::DestoryTestSVMProb()
 {
 	if (mTestSVMProb.y) {
 		delete[] mTestSVMProb.y;
+		mTestSVMProb.y = nullptr;
 	}
-	
-	if (mTestSVMProb.x) {
-		for (size_t i = 0; i < mTestEigenSpaceNormLen; i++) {
-			delete[] mTestSVMProb.x[i];
-		}
-		delete[] mTestSVMProb.x;
-	}
+
+	DeleteNodeMatrix(mTestSVMProb.x, mTestSVMProbArena);
 }
 
 void RelocalizationJudger::LoadPythonModule()
@@ -157,239 +185,256 @@ void RelocalizationJudger::SetPythonWorkPath(const string path)
 	PyObject_CallObject(pFunSetPath, pArgs);
 }
 
+void RelocalizationJudger::SetRawDataToPython()
+{
+	// Hand the natively loaded dataset over to python module as float64 buffers
+	PyObject *pFunSetData;
+	pFunSetData = PyObject_GetAttrString(mPyModule, mSetDataFunCfg);
+
+	PyObject *pEigenNames = PyList_New(mNumOfEigenElem);
+	for (size_t i = 0; i < mNumOfEigenElem; i++) {
+		PyList_SetItem(pEigenNames, i, PyUnicode_FromString(mJudgerModel.eigenNames[i].c_str()));
+	}
+
+	PyObject *pEigenSpace = PyBytes_FromStringAndSize(NULL, mRawEigenSpaceLen * mNumOfEigenElem * sizeof(double));
+	double *eigenSpace = (double *)PyBytes_AsString(pEigenSpace);
+	for (size_t i = 0; i < mRawEigenSpaceLen; i++) {
+		for (size_t j = 0; j < mNumOfEigenElem; j++) {
+			eigenSpace[i * mNumOfEigenElem + j] = mRawEigenSpace[i][j].value;
+		}
+	}
+
+	PyObject *pLabel = PyBytes_FromStringAndSize((const char *)mRawLabel, mRawEigenSpaceLen * sizeof(double));
+
+	PyObject *pArgs = PyTuple_New(4);
+	PyTuple_SetItem(pArgs, 0, pEigenNames);
+	PyTuple_SetItem(pArgs, 1, pEigenSpace);
+	PyTuple_SetItem(pArgs, 2, pLabel);
+	PyTuple_SetItem(pArgs, 3, PyBool_FromLong(mRawDataChanged));
+	PyObject_CallObject(pFunSetData, pArgs);
+	Py_DECREF(pArgs);
+}
+
 void RelocalizationJudger::PythonTrainAndOptimize()
 {
-	// Split dataset and run sklearn to train and optimize model parameters
+	// Split and normalize dataset in python module
 	PyObject *pFunRunPyModule;
 	pFunRunPyModule = PyObject_GetAttrString(mPyModule, mRunPyModuleFunCfg);
 	PyObject_CallObject(pFunRunPyModule, NULL);
 }
 
-void RelocalizationJudger::GetRawDataFromPython()
+void RelocalizationJudger::PythonAnalyze()
 {
-	PyObject *pFuncGetEigenNames, *pFuncGetEigenSpace, *pFuncGetLabel;
-	PyObject *pEigenNames, *pEigenSpace, *pLabel;
-
-	pFuncGetEigenNames = PyObject_GetAttrString(mPyModule, mGetEigenNamesFunCfg);
-	pEigenNames = PyObject_CallObject(pFuncGetEigenNames, NULL);
-
-	pFuncGetEigenSpace = PyObject_GetAttrString(mPyModule, mGetEigenSpaceFunCfg);
-	pEigenSpace = PyObject_CallObject(pFuncGetEigenSpace, NULL);
-
-	pFuncGetLabel = PyObject_GetAttrString(mPyModule, mGetLableFunCfg);
-	pLabel = PyObject_CallObject(pFuncGetLabel, NULL);
-
-	// Check length of data tuple
-	size_t sizeOfListEigenSpace = PyList_Size(pEigenSpace);
-	size_t sizeOfListLabel = PyList_Size(pLabel);
+	// Draw learning curve and ROC curve with the searched parameters
+	PyObject *pFunAnalyze;
+	pFunAnalyze = PyObject_GetAttrString(mPyModule, mAnalyzeFunCfg);
+	PyObject *pArgs = PyTuple_New(2);
+	PyTuple_SetItem(pArgs, 0, PyFloat_FromDouble(mSVMParam.C));
+	PyTuple_SetItem(pArgs, 1, PyFloat_FromDouble(mSVMParam.gamma));
+	PyObject_CallObject(pFunAnalyze, pArgs);
+	Py_DECREF(pArgs);
+}
 
-	if (sizeOfListEigenSpace != sizeOfListLabel) {
-		cout << "sizeOfListEigenSpace != sizeOfListLabel" << endl;
-		system("pause");
-		return;
+bool RelocalizationJudger::GetBufferFromPython(const char * funName, size_t numOfCols, Py_buffer &buffer)
+{
+	// Call the getter and view the returned ndarray through the buffer protocol,
+	// numOfCols == 0 means a vector is expected
+	PyObject *pFunc, *pArray;
+
+	pFunc = PyObject_GetAttrString(mPyModule, funName);
+	pArray = PyObject_CallObject(pFunc, NULL);
+	if (pArray == nullptr || PyObject_GetBuffer(pArray, &buffer, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+		cout << funName << "(): result does not support buffer protocol!" << endl;
+		PyErr_Clear();
+		Py_XDECREF(pArray);
+		return false;
 	}
-
-	// Malloc and fill the names of eigen elements
-	mNumOfEigenElem = PyList_Size(pEigenNames);
-
-	for (size_t i = 0; i < mNumOfEigenElem; i++) {
-		PyObject *pItemEigenName = PyList_GetItem(pEigenNames, i);
-		mJudgerModel.eigenNames.push_back(PyUnicode_AsUTF8(pItemEigenName));
+	Py_DECREF(pArray);		// Kept alive by the buffer
+
+	int expectedDim = numOfCols ? 2 : 1;
+	if (buffer.itemsize != sizeof(double) || buffer.format == nullptr || strchr(buffer.format, 'd') == nullptr
+		|| buffer.ndim != expectedDim || (numOfCols && (size_t)buffer.shape[1] != numOfCols)) {
+		cout << funName << "(): result is not a float64 array of " << expectedDim << " dim!" << endl;
+		PyBuffer_Release(&buffer);
+		return false;
 	}
+	return true;
+}
 
-	// Malloc and fill the eigen space and label
-	mRawEigenSpaceLen = sizeOfListEigenSpace;
-	mRawLabel = new double[mRawEigenSpaceLen];
-	mRawEigenSpace = new svm_node *[mRawEigenSpaceLen];
-
-	for (size_t i = 0; i < mRawEigenSpaceLen; i++) {
-		mRawEigenSpace[i] = new svm_node[mNumOfEigenElem];
-		PyObject *pListEigenVector = PyList_GetItem(pEigenSpace, i);
-		for (size_t j = 0; j < mNumOfEigenElem; j++) {
-			PyObject *pItemEigen = PyList_GetItem(pListEigenVector, j);
-			mRawEigenSpace[i][j].index = j;
-			mRawEigenSpace[i][j].value = PyFloat_AsDouble(pItemEigen);
-		}
-		PyObject *pItemLabel = PyList_GetItem(pLabel, i);
-		mRawLabel[i] = PyFloat_AsDouble(pItemLabel);
+void RelocalizationJudger::NormalizeEigenVector(const double * eigenVec, svm_node * node)
+{
+	// Same as Normalize() in python module
+	size_t j = 0;
+	for (; j < mNumOfEigenElem; j++) {
+		node[j].index = j;
+		node[j].value = ((eigenVec[j] - mJudgerModel.eigenMeans[j]) / mJudgerModel.eigenStds[j]) * mJudgerModel.eigenRatio;
 	}
+	node[j].index = -1;		// Separator in libsvm
+	node[j].value = 0;
 }
 
 void RelocalizationJudger::GetTrainDataFromPython()
 {
-	PyObject *pFuncGetXtrain, *pFuncGetXtrainNorm, *pFuncGetYtrain;
-	PyObject *pXtrain, *pXtrainNorm, *pYtrain;
+	Py_buffer xTrain, yTrain;
 
-	pFuncGetXtrain = PyObject_GetAttrString(mPyModule, mGetTrainEigenFunCfg);
-	pXtrain = PyObject_CallObject(pFuncGetXtrain, NULL);
-
-	pFuncGetXtrainNorm = PyObject_GetAttrString(mPyModule, mGetTrainEigenNormFunCfg);
-	pXtrainNorm = PyObject_CallObject(pFuncGetXtrainNorm, NULL);
-
-	pFuncGetYtrain = PyObject_GetAttrString(mPyModule, mGetTrainLableFunCfg);
-	pYtrain = PyObject_CallObject(pFuncGetYtrain, NULL);
-
-	// Check length of data tuple
-	size_t sizeOfListXtrain = PyList_Size(pXtrain);
-	size_t sizeOfListXtrainNorm = PyList_Size(pXtrainNorm);
-	size_t sizeOfListYtrain = PyList_Size(pYtrain);
-
-	if (sizeOfListXtrain != sizeOfListXtrainNorm
-		|| sizeOfListXtrain != sizeOfListYtrain
-		|| sizeOfListXtrainNorm != sizeOfListYtrain) {
-		cout << "sizeOfListXtrain, sizeOfListXtrainNorm and sizeOfListYtrain is different!" << endl;
+	if (!GetBufferFromPython(mGetTrainEigenFunCfg, mNumOfEigenElem, xTrain)) {
 		system("pause");
 		return;
 	}
 
-	// Check number of eigen elements
-	PyObject *pListItemXtrainNorm = PyList_GetItem(pXtrainNorm, 0);
-	size_t numOfItemXtrainNorm = PyList_Size(pListItemXtrainNorm);
+	if (!GetBufferFromPython(mGetTrainLableFunCfg, 0, yTrain)) {
+		PyBuffer_Release(&xTrain);
+		system("pause");
+		return;
+	}
 
-	if (numOfItemXtrainNorm != mNumOfEigenElem) {
-		cout << "The number of train data eigen elements is wrong!" << endl;
+	// Check length of data
+	if (xTrain.shape[0] != yTrain.shape[0]) {
+		cout << "sizeOfXtrain and sizeOfYtrain is different!" << endl;
+		PyBuffer_Release(&xTrain);
+		PyBuffer_Release(&yTrain);
 		system("pause");
 		return;
 	}
 
+	const double *pXtrain = (const double *)xTrain.buf;
+	const double *pYtrain = (const double *)yTrain.buf;
+
 	// Malloc and fill the train eigen space
-	mTrainEigenSpaceLen = sizeOfListXtrain;
-	mTrainEigenSpace = new svm_node *[mTrainEigenSpaceLen];
+	mTrainEigenSpaceLen = xTrain.shape[0];
+	mTrainEigenSpace = NewNodeMatrix(mTrainEigenSpaceLen, mNumOfEigenElem, mTrainEigenSpaceArena);
 
 	for (size_t i = 0; i < mTrainEigenSpaceLen; i++) {
-		mTrainEigenSpace[i] = new svm_node[mNumOfEigenElem];
-		PyObject *pListItemXtrain = PyList_GetItem(pXtrain, i);
 		for (size_t j = 0; j < mNumOfEigenElem; j++) {
-			PyObject *pItemXtrain = PyList_GetItem(pListItemXtrain, j);
 			mTrainEigenSpace[i][j].index = j;
-			mTrainEigenSpace[i][j].value = PyFloat_AsDouble(pItemXtrain);
+			mTrainEigenSpace[i][j].value = pXtrain[i * mNumOfEigenElem + j];
 		}
 	}
 
-	// Malloc and fill the train svm problem
-	mTrainEigenSpaceNormLen = sizeOfListXtrainNorm;
+	// Many positions give the same small integer eigen vector with the same label.
+	// Keep the first of those rows and count the others as its instance weight,
+	// the solver bounds its alpha by weight * C, which trains the same model on fewer rows
+	// (up to eps). The folds of the grid search and of the probability estimates then split
+	// unique rows, so the copies of a row are never on both sides of a fold and the CV
+	// scores differ from those on all rows
+	vector<size_t> uniqueRows;
+	vector<double> weights;
+	if (mDedupTrainSamplesCfg) {
+		unordered_map<string, size_t> rowOfKey;
+		rowOfKey.reserve(mTrainEigenSpaceLen);
+		for (size_t i = 0; i < mTrainEigenSpaceLen; i++) {
+			string key((const char *)(pXtrain + i * mNumOfEigenElem), mNumOfEigenElem * sizeof(double));
+			key.append((const char *)(pYtrain + i), sizeof(double));
+			auto found = rowOfKey.find(key);
+			if (found == rowOfKey.end()) {
+				rowOfKey.emplace(key, uniqueRows.size());
+				uniqueRows.push_back(i);
+				weights.push_back(1);
+			} else {
+				weights[found->second] += 1;
+			}
+		}
+		cout << "Train samples: " << mTrainEigenSpaceLen << ", unique: " << uniqueRows.size() << endl;
+	} else {
+		for (size_t i = 0; i < mTrainEigenSpaceLen; i++) {
+			uniqueRows.push_back(i);
+		}
+	}
+
+	// Malloc and fill the train svm problem, normalized natively
+	mTrainEigenSpaceNormLen = uniqueRows.size();
 	mTrainSVMProb.l = mTrainEigenSpaceNormLen;
 	mTrainSVMProb.y = new double[mTrainEigenSpaceNormLen];
-	mTrainSVMProb.x = new svm_node *[mTrainEigenSpaceNormLen];
+	mTrainSVMProb.x = NewNodeMatrix(mTrainEigenSpaceNormLen, mNumOfEigenElem + 1, mTrainSVMProbArena);
+	mTrainSVMProb.W = nullptr;
+	if (mDedupTrainSamplesCfg) {
+		mTrainSVMProb.W = new double[mTrainEigenSpaceNormLen];
+		memcpy(mTrainSVMProb.W, weights.data(), mTrainEigenSpaceNormLen * sizeof(double));
+	}
 
 	for (size_t i = 0; i < mTrainEigenSpaceNormLen; i++) {
-		mTrainSVMProb.x[i] = new svm_node[mNumOfEigenElem + 1];
-		PyObject *pListItemXtrainNorm = PyList_GetItem(pXtrainNorm, i);
-		size_t j = 0;
-		for (; j < mNumOfEigenElem; j++) {
-			PyObject *pItemXtrainNorm = PyList_GetItem(pListItemXtrainNorm, j);
-			mTrainSVMProb.x[i][j].index = j;
-			mTrainSVMProb.x[i][j].value = PyFloat_AsDouble(pItemXtrainNorm);
-		}
-		mTrainSVMProb.x[i][j].index = -1;	// Separator in libsvm
-		mTrainSVMProb.x[i][j].value = 0;
-
-		PyObject *pItemYtrain = PyList_GetItem(pYtrain, i);
-		mTrainSVMProb.y[i] = PyFloat_AsDouble(pItemYtrain);
+		mTrainSVMProb.y[i] = pYtrain[uniqueRows[i]];
+		NormalizeEigenVector(pXtrain + uniqueRows[i] * mNumOfEigenElem, mTrainSVMProb.x[i]);
 	}
+
+	PyBuffer_Release(&xTrain);
+	PyBuffer_Release(&yTrain);
 }
 
 void RelocalizationJudger::GetTestDataFromPython()
 {
-	PyObject *pFuncGetXtest, *pFuncGetXtestNorm, *pFuncGetYtest;
-	PyObject *pXtest, *pXtestNorm, *pYtest;
+	Py_buffer xTest, yTest;
 
-	pFuncGetXtest = PyObject_GetAttrString(mPyModule, mGetTestEigenFunCfg);
-	pXtest = PyObject_CallObject(pFuncGetXtest, NULL);
-
-	pFuncGetXtestNorm = PyObject_GetAttrString(mPyModule, mGetTestEigenNormFunCfg);
-	pXtestNorm = PyObject_CallObject(pFuncGetXtestNorm, NULL);
-
-	pFuncGetYtest = PyObject_GetAttrString(mPyModule, mGetTestLableFunCfg);
-	pYtest = PyObject_CallObject(pFuncGetYtest, NULL);
-
-	// Check length of data tuple
-	size_t sizeOfListXtest = PyList_Size(pXtest);
-	size_t sizeOfListXtestNorm = PyList_Size(pXtestNorm);
-	size_t sizeOfListYtest = PyList_Size(pYtest);
-
-	if (sizeOfListXtest != sizeOfListXtestNorm
-		|| sizeOfListXtest != sizeOfListYtest
-		|| sizeOfListXtestNorm != sizeOfListYtest) {
-		cout << "sizeOfListXtest, sizeOfListXtestNorm and sizeOfListYtest is different!" << endl;
+	if (!GetBufferFromPython(mGetTestEigenFunCfg, mNumOfEigenElem, xTest)) {
 		system("pause");
 		return;
 	}
 
-	// Check number of eigen elements
-	PyObject *pListItemXtestNorm = PyList_GetItem(pXtestNorm, 0);
-	size_t numOfItemXtestNorm = PyList_Size(pListItemXtestNorm);
+	if (!GetBufferFromPython(mGetTestLableFunCfg, 0, yTest)) {
+		PyBuffer_Release(&xTest);
+		system("pause");
+		return;
+	}
 
-	if (numOfItemXtestNorm != mNumOfEigenElem) {
-		cout << "The number of train data eigen elements is wrong!" << endl;
+	// Check length of data
+	if (xTest.shape[0] != yTest.shape[0]) {
+		cout << "sizeOfXtest and sizeOfYtest is different!" << endl;
+		PyBuffer_Release(&xTest);
+		PyBuffer_Release(&yTest);
 		system("pause");
 		return;
 	}
 
+	const double *pXtest = (const double *)xTest.buf;
+	const double *pYtest = (const double *)yTest.buf;
+
 	// Malloc and fill the test eigen space
-	mTestEigenSpaceLen = sizeOfListXtest;
-	mTestEigenSpace = new svm_node *[mTestEigenSpaceLen];
+	mTestEigenSpaceLen = xTest.shape[0];
+	mTestEigenSpace = NewNodeMatrix(mTestEigenSpaceLen, mNumOfEigenElem, mTestEigenSpaceArena);
 
 	for (size_t i = 0; i < mTestEigenSpaceLen; i++) {
-		mTestEigenSpace[i] = new svm_node[mNumOfEigenElem];
-		PyObject *pListItemXtest = PyList_GetItem(pXtest, i);
 		for (size_t j = 0; j < mNumOfEigenElem; j++) {
-			PyObject *pItemXtest = PyList_GetItem(pListItemXtest, j);
 			mTestEigenSpace[i][j].index = j;
-			mTestEigenSpace[i][j].value = PyFloat_AsDouble(pItemXtest);
+			mTestEigenSpace[i][j].value = pXtest[i * mNumOfEigenElem + j];
 		}
 	}
 
-	// Malloc and fill the test svm problem
-	mTestEigenSpaceNormLen = sizeOfListXtestNorm;
+	// Malloc and fill the test svm problem, normalized natively
+	mTestEigenSpaceNormLen = mTestEigenSpaceLen;
 	mTestSVMProb.l = mTestEigenSpaceNormLen;
 	mTestSVMProb.y = new double[mTestEigenSpaceNormLen];
-	mTestSVMProb.x = new svm_node *[mTestEigenSpaceNormLen];
+	mTestSVMProb.x = NewNodeMatrix(mTestEigenSpaceNormLen, mNumOfEigenElem + 1, mTestSVMProbArena);
 
+	memcpy(mTestSVMProb.y, pYtest, mTestEigenSpaceNormLen * sizeof(double));
 	for (size_t i = 0; i < mTestEigenSpaceNormLen; i++) {
-		mTestSVMProb.x[i] = new svm_node[mNumOfEigenElem + 1];
-		PyObject *pListItemXtestNorm = PyList_GetItem(pXtestNorm, i);
-		size_t j = 0;
-		for (; j < mNumOfEigenElem; j++) {
-			PyObject *pItemXtestNorm = PyList_GetItem(pListItemXtestNorm, j);
-			mTestSVMProb.x[i][j].index = j;
-			mTestSVMProb.x[i][j].value = PyFloat_AsDouble(pItemXtestNorm);
-		}
-		mTestSVMProb.x[i][j].index = -1;	// Separator in libsvm
-		mTestSVMProb.x[i][j].value = 0;
-
-		PyObject *pItemYtest = PyList_GetItem(pYtest, i);
-		mTestSVMProb.y[i] = PyFloat_AsDouble(pItemYtest);
+		NormalizeEigenVector(pXtest + i * mNumOfEigenElem, mTestSVMProb.x[i]);
 	}
+
+	PyBuffer_Release(&xTest);
+	PyBuffer_Release(&yTest);
 }
 
 void RelocalizationJudger::GetDataFromPython()
 {
-	GetRawDataFromPython();
 	GetTrainDataFromPython();
 	GetTestDataFromPython();
 }
 
 void RelocalizationJudger::GetMeanAndStdFromPython()
 {
-	PyObject *pFuncGetMeanAndStd;
-	PyObject *pMeanAndStd;
-
-	// Get mean and std from train dataset
-	pFuncGetMeanAndStd = PyObject_GetAttrString(mPyModule, mGetMeanAndStdFunCfg);
-	pMeanAndStd = PyObject_CallObject(pFuncGetMeanAndStd, NULL);
+	Py_buffer meanAndStd;
 
-	PyObject *pListItemMean = PyList_GetItem(pMeanAndStd, 0);
-	for (size_t index = 0; index < mNumOfEigenElem; index++) {
-		PyObject *pItemMean = PyList_GetItem(pListItemMean, index);
-		mJudgerModel.eigenMeans.push_back(PyFloat_AsDouble(pItemMean));
+	// Get mean and std from train dataset, row 0 is mean and row 1 is std
+	if (!GetBufferFromPython(mGetMeanAndStdFunCfg, mNumOfEigenElem, meanAndStd)) {
+		system("pause");
+		return;
 	}
 
-	PyObject *pListItemStd = PyList_GetItem(pMeanAndStd, 1);
-	for (size_t index = 0; index < mNumOfEigenElem; index++) {
-		PyObject *pItemStd = PyList_GetItem(pListItemStd, index);
-		mJudgerModel.eigenStds.push_back(PyFloat_AsDouble(pItemStd));
-	}
+	const double *pMeanAndStd = (const double *)meanAndStd.buf;
+	mJudgerModel.eigenMeans.assign(pMeanAndStd, pMeanAndStd + mNumOfEigenElem);
+	mJudgerModel.eigenStds.assign(pMeanAndStd + mNumOfEigenElem, pMeanAndStd + 2 * mNumOfEigenElem);
+
+	PyBuffer_Release(&meanAndStd);
 }
 
 void RelocalizationJudger::GetRatioFromPython()
@@ -413,13 +458,11 @@ void RelocalizationJudger::GetParamsFromPython()
 
 	size_t numOfItemParams = PyList_Size(pParam);
 	if (numOfItemParams == SVM_PARAMS_NUM) {
-		// Params: C cache_size degree gamma eps
+		// Params: cache_size degree eps, C and gamma come from SearchSVMParam()
 		mSVMParam.svm_type = C_SVC;
-		mSVMParam.C = PyFloat_AsDouble(PyList_GetItem(pParam, 0));
-		mSVMParam.cache_size = PyFloat_AsDouble(PyList_GetItem(pParam, 1));
-		mSVMParam.degree = PyFloat_AsDouble(PyList_GetItem(pParam, 2));
-		mSVMParam.gamma = PyFloat_AsDouble(PyList_GetItem(pParam, 3));
-		mSVMParam.eps = PyFloat_AsDouble(PyList_GetItem(pParam, 4));
+		mSVMParam.cache_size = PyFloat_AsDouble(PyList_GetItem(pParam, 0));
+		mSVMParam.degree = PyFloat_AsDouble(PyList_GetItem(pParam, 1));
+		mSVMParam.eps = PyFloat_AsDouble(PyList_GetItem(pParam, 2));
 		mSVMParam.kernel_type = RBF;
 		mSVMParam.coef0 = 0.0;
 		mSVMParam.shrinking = 1;
@@ -429,6 +472,10 @@ void RelocalizationJudger::GetParamsFromPython()
 		mSVMParam.nu = 0.0;
 		mSVMParam.weight = NULL;
 		mSVMParam.p = 0;
+		mSVMParam.nr_thread = 0;	// 线程数由 SVM_NUM_THREADS 或线程池决定
+		mSVMParam.nr_prob_fold = 0;	// 概率模型的折数由 SVM_PROB_FOLDS 决定，默认 5 折
+		mSVMParam.seed = 0;
+		mSVMParam.float_storage = 0;	// 特征按 double 存储，float 只在 PredictAndAnalysis 中对比
 	} else {
 		cout << "GetParamsFromPython(): the num of params error!" << endl;
 		system("pause");
@@ -436,6 +483,36 @@ void RelocalizationJudger::GetParamsFromPython()
 	}
 }
 
+void RelocalizationJudger::LoadRawData(const string workPath)
+{
+	DatasetLoader loader;
+	RawDataset dataset;
+
+	if (!loader.Load(workPath, dataset)) {
+		cout << "LoadRawData(): load dataset failed!" << endl;
+		system("pause");
+		return;
+	}
+
+	// Fill the names of eigen elements
+	mRawDataChanged = dataset.changed;
+	mNumOfEigenElem = dataset.eigenNames.size();
+	mJudgerModel.eigenNames = dataset.eigenNames;
+
+	// Malloc and fill the eigen space and label
+	mRawEigenSpaceLen = dataset.label.size();
+	mRawLabel = new double[mRawEigenSpaceLen];
+	mRawEigenSpace = NewNodeMatrix(mRawEigenSpaceLen, mNumOfEigenElem, mRawEigenSpaceArena);
+
+	for (size_t i = 0; i < mRawEigenSpaceLen; i++) {
+		for (size_t j = 0; j < mNumOfEigenElem; j++) {
+			mRawEigenSpace[i][j].index = j;
+			mRawEigenSpace[i][j].value = dataset.eigenSpace[i * mNumOfEigenElem + j];
+		}
+		mRawLabel[i] = dataset.label[i];
+	}
+}
+
 void RelocalizationJudger::RunPythonModule(const string workPath)
 {
 	Py_Initialize();
@@ -448,15 +525,35 @@ void RelocalizationJudger::RunPythonModule(const string workPath)
 
 	LoadPythonModule();
 	SetPythonWorkPath(workPath);
+	SetRawDataToPython();
 	PythonTrainAndOptimize();
-	GetDataFromPython();
-	GetParamsFromPython();
 	GetMeanAndStdFromPython();
 	GetRatioFromPython();
+	GetDataFromPython();
+	GetParamsFromPython();
+	SearchSVMParam(workPath + mAnalysisMidPathCfg + mGridSearchScoreFileNameCfg);
+	PythonAnalyze();
 
 	Py_Finalize();
 }
 
+void RelocalizationJudger::SearchSVMParam(const string path)
+{
+	// Native grid search of C and gamma, the best point goes straight into mSVMParam.
+	// Successive halving drops hopeless points on subsamples, the exhaustive search scores all of them
+	GridSearch search;
+	bool searched = mHalvingSearchCfg ? search.RunHalving(mTrainSVMProb, mSVMParam) : search.Run(mTrainSVMProb, mSVMParam);
+	if (!searched) {
+		cout << "SearchSVMParam(): grid search failed!" << endl;
+		system("pause");
+		return;
+	}
+
+	mSVMParam.C = search.Best().C;
+	mSVMParam.gamma = search.Best().gamma;
+	search.SaveScores(path);
+}
+
 void RelocalizationJudger::RunSVMModule()
 {
 	const char * errorMsg = svm_check_parameter(&mTrainSVMProb, &mSVMParam);
@@ -467,6 +564,32 @@ void RelocalizationJudger::RunSVMModule()
 	}
 
 	mJudgerModel.svmModel = svm_train(&mTrainSVMProb, &mSVMParam);
+	if (mReducedNumOfSVCfg > 0)
+		ReduceSVMModel();
+	mJudgerModel.generation = ++mModelGeneration;
+}
+
+// Merge the support vectors of the trained model, so the exported predictor does
+// less work per call; the decision value of any input moves by at most the loss
+void RelocalizationJudger::ReduceSVMModel()
+{
+	double loss = 0;
+	svm_model *reduced = svm_reduce_model(mJudgerModel.svmModel, mReducedNumOfSVCfg, mReducedMaxLossCfg, &loss);
+	if (reduced == nullptr) {
+		cout << "ReduceSVMModel(): only binary RBF model can be reduced, keep the full model" << endl;
+		return;
+	}
+	if (reduced->l == mJudgerModel.svmModel->l) {
+		cout << "ReduceSVMModel(): no reduction within the max loss " << mReducedMaxLossCfg << ", keep the full model" << endl;
+		svm_free_and_destroy_model(&reduced);
+		return;
+	}
+
+	cout << "ReduceSVMModel(): " << mJudgerModel.svmModel->l << " -> " << reduced->l
+		<< " support vectors, decision value changes at most " << loss << endl;
+	svm_free_and_destroy_model(&mJudgerModel.fullSvmModel);
+	mJudgerModel.fullSvmModel = mJudgerModel.svmModel;
+	mJudgerModel.svmModel = reduced;
 }
 
 void RelocalizationJudger::SaveJudgerModel(const string path)
@@ -569,16 +692,189 @@ void RelocalizationJudger::SaveJudgerModel(const string path)
 	}
 	fprintf(fp, "};\n");
 
+	// Squared norms of the SVs as written above (%.8g), so that
+	// K(x, sv) = exp(-GAMMA * (|x|^2 + gSVSquare[i] - 2 * x.sv)) needs one dot product per SV
+	fprintf(fp, "double gSVSquare[%d] = {\n", mJudgerModel.svmModel->l);
+	for (int i = 0; i < mJudgerModel.svmModel->l; i++) {
+		double svSquare = 0;
+		for (size_t j = 0; j < mNumOfEigenElem; j++) {
+			char text[32];
+			snprintf(text, sizeof(text), "%.8g", SV[i][j].value);
+			double value = strtod(text, nullptr);
+			svSquare += value * value;
+		}
+		fprintf(fp, (i == mJudgerModel.svmModel->l - 1) ? "%.17g\n" : "%.17g,\n", svSquare);
+	}
+	fprintf(fp, "};\n");
+
 	setlocale(LC_ALL, old_locale);
 	free(old_locale);
 
-	if (ferror(fp) != 0 || fclose(fp) != 0) {
+	bool failed = (ferror(fp) != 0);
+	if (fclose(fp) != 0) {
+		failed = true;
+	}
+	if (failed) {
 		cout << "SaveJudgerModel(): file write error!" << endl;
 		system("pause");
 		return;
 	}
 }
 
+void RelocalizationJudger::SaveJudgerPredictor(const string path)
+{
+	const svm_model *model = mJudgerModel.svmModel;
+	if (model->param.kernel_type != RBF || model->nr_class != 2) {
+		cout << "SaveJudgerPredictor(): only binary RBF models can be compiled!" << endl;
+		system("pause");
+		return;
+	}
+
+	if (mJudgerModel.eigenMeans.size() != mNumOfEigenElem || mJudgerModel.eigenStds.size() != mNumOfEigenElem) {
+		cout << "SaveJudgerPredictor(): the size of eigenMeans or eigenStds error!" << endl;
+		system("pause");
+		return;
+	}
+
+	FILE *fp;
+	fopen_s(&fp, path.c_str(), "w");
+	if (fp == nullptr) {
+		cout << "SaveJudgerPredictor(): can not open file!" << endl;
+		system("pause");
+		return;
+	}
+
+	char *old_locale = setlocale(LC_ALL, NULL);
+	if (old_locale) {
+		old_locale = strdup(old_locale);
+	}
+	setlocale(LC_ALL, "C");
+
+	// Fold normalization and gamma into the constants:
+	// u = x * scale + offset is the normalized eigen vector times sqrt(gamma),
+	// sv is stored times sqrt(gamma), so gamma * |x' - sv'|^2 = |u|^2 - 2 u.sv + |sv|^2
+	double sqrtGamma = sqrt(model->param.gamma);
+	vector<double> scale(mNumOfEigenElem), offset(mNumOfEigenElem);
+	for (size_t j = 0; j < mNumOfEigenElem; j++) {
+		scale[j] = sqrtGamma * mJudgerModel.eigenRatio / mJudgerModel.eigenStds[j];
+		offset[j] = -mJudgerModel.eigenMeans[j] * scale[j];
+	}
+
+	int l = model->l;
+	size_t n = mNumOfEigenElem;
+
+	fprintf(fp, "#pragma once\n\n");
+	fprintf(fp, "#include <math.h>\n\n");
+	fprintf(fp, "// Generated by SaveJudgerPredictor(), normalization and gamma are folded into the constants.\n");
+	fprintf(fp, "// u = x * gEigenScale + gEigenOffset is the normalized eigen vector times sqrt(gamma),\n");
+	fprintf(fp, "// gSV is sqrt(gamma) * sv and gSVSquare is gamma * |sv|^2, so K(x, sv) = exp(2 u.sv - |u|^2 - gSVSquare)\n");
+	fprintf(fp, "namespace judger_predictor {\n\n");
+
+	fprintf(fp, "constexpr int gNumOfEigenElem = %zu;\n", n);
+	fprintf(fp, "constexpr int gTotalSV = %d;\n", l);
+	fprintf(fp, "constexpr int gLabel[2] = { %d, %d };\n", model->label[0], model->label[1]);
+	fprintf(fp, "constexpr double gRho = %.17g;\n", model->rho[0]);
+	if (model->probA && model->probB) {
+		fprintf(fp, "constexpr double gProbA = %.17g;\n", model->probA[0]);
+		fprintf(fp, "constexpr double gProbB = %.17g;\n", model->probB[0]);
+	}
+
+	fprintf(fp, "constexpr double gEigenScale[%zu] = { ", n);
+	for (size_t j = 0; j < n; j++) {
+		fprintf(fp, (j == n - 1) ? "%.17g };\n" : "%.17g, ", scale[j]);
+	}
+	fprintf(fp, "constexpr double gEigenOffset[%zu] = { ", n);
+	for (size_t j = 0; j < n; j++) {
+		fprintf(fp, (j == n - 1) ? "%.17g };\n" : "%.17g, ", offset[j]);
+	}
+
+	fprintf(fp, "constexpr double gSVCoef[%d] = {\n", l);
+	for (int i = 0; i < l; i++) {
+		fprintf(fp, (i == l - 1) ? "%.17g\n" : "%.17g,\n", model->sv_coef[0][i]);
+	}
+	fprintf(fp, "};\n");
+
+	vector<double> svSquare(l);
+	fprintf(fp, "constexpr double gSV[%d][%zu] = {\n", l, n);
+	for (int i = 0; i < l; i++) {
+		const svm_node *p = model->SV[i];
+		svSquare[i] = 0;
+		fprintf(fp, "{ ");
+		for (size_t j = 0; j < n; j++) {
+			double value = sqrtGamma * p[j].value;
+			svSquare[i] += value * value;
+			fprintf(fp, (j == n - 1) ? "%.17g }" : "%.17g, ", value);
+		}
+		fprintf(fp, (i == l - 1) ? "\n" : ",\n");
+	}
+	fprintf(fp, "};\n");
+
+	fprintf(fp, "constexpr double gSVSquare[%d] = {\n", l);
+	for (int i = 0; i < l; i++) {
+		fprintf(fp, (i == l - 1) ? "%.17g\n" : "%.17g,\n", svSquare[i]);
+	}
+	fprintf(fp, "};\n\n");
+
+	// Compile time unrolled loops over the eigen elements
+	fprintf(fp, "template <int J>\n");
+	fprintf(fp, "struct Unroll {\n");
+	fprintf(fp, "\tstatic inline void Normalize(const double *x, double *u) {\n");
+	fprintf(fp, "\t\tUnroll<J - 1>::Normalize(x, u);\n");
+	fprintf(fp, "\t\tu[J - 1] = x[J - 1] * gEigenScale[J - 1] + gEigenOffset[J - 1];\n");
+	fprintf(fp, "\t}\n");
+	fprintf(fp, "\tstatic inline double Dot(const double *u, const double *v) {\n");
+	fprintf(fp, "\t\treturn Unroll<J - 1>::Dot(u, v) + u[J - 1] * v[J - 1];\n");
+	fprintf(fp, "\t}\n");
+	fprintf(fp, "};\n\n");
+	fprintf(fp, "template <>\n");
+	fprintf(fp, "struct Unroll<0> {\n");
+	fprintf(fp, "\tstatic inline void Normalize(const double *, double *) {}\n");
+	fprintf(fp, "\tstatic inline double Dot(const double *, const double *) { return 0; }\n");
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp, "template <int NumOfEigenElem, int TotalSV>\n");
+	fprintf(fp, "struct Predictor {\n");
+	fprintf(fp, "\t// Same as svm_predict_values() of libsvm on the normalized eigen vector\n");
+	fprintf(fp, "\tstatic inline double DecisionValue(const double (&eigenVec)[NumOfEigenElem]) {\n");
+	fprintf(fp, "\t\tdouble u[NumOfEigenElem];\n");
+	fprintf(fp, "\t\tUnroll<NumOfEigenElem>::Normalize(eigenVec, u);\n");
+	fprintf(fp, "\t\tdouble uu = Unroll<NumOfEigenElem>::Dot(u, u);\n");
+	fprintf(fp, "\t\tdouble sum = 0;\n");
+	fprintf(fp, "\t\tfor (int i = 0; i < TotalSV; i++) {\n");
+	fprintf(fp, "\t\t\tsum += gSVCoef[i] * exp(2 * Unroll<NumOfEigenElem>::Dot(u, gSV[i]) - uu - gSVSquare[i]);\n");
+	fprintf(fp, "\t\t}\n");
+	fprintf(fp, "\t\treturn sum - gRho;\n");
+	fprintf(fp, "\t}\n\n");
+	fprintf(fp, "\tstatic inline int Predict(const double (&eigenVec)[NumOfEigenElem]) {\n");
+	fprintf(fp, "\t\treturn (DecisionValue(eigenVec) > 0) ? gLabel[0] : gLabel[1];\n");
+	fprintf(fp, "\t}\n");
+	if (model->probA && model->probB) {
+		fprintf(fp, "\n");
+		fprintf(fp, "\t// Probability of gLabel[0], same as sigmoid_predict() of libsvm\n");
+		fprintf(fp, "\tstatic inline double Probability(const double (&eigenVec)[NumOfEigenElem]) {\n");
+		fprintf(fp, "\t\tdouble fApB = DecisionValue(eigenVec) * gProbA + gProbB;\n");
+		fprintf(fp, "\t\treturn (fApB >= 0) ? exp(-fApB) / (1.0 + exp(-fApB)) : 1.0 / (1 + exp(fApB));\n");
+		fprintf(fp, "\t}\n");
+	}
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp, "typedef Predictor<gNumOfEigenElem, gTotalSV> JudgerPredictor;\n\n");
+	fprintf(fp, "}\n");
+
+	setlocale(LC_ALL, old_locale);
+	free(old_locale);
+
+	bool failed = (ferror(fp) != 0);
+	if (fclose(fp) != 0) {
+		failed = true;
+	}
+	if (failed) {
+		cout << "SaveJudgerPredictor(): file write error!" << endl;
+		system("pause");
+		return;
+	}
+}
+
 double RelocalizationJudger::OldJudger(const svm_node * eigenVec)
 {
 	double predict_label = 0;
@@ -608,9 +904,30 @@ double RelocalizationJudger::OldJudger(const svm_node * eigenVec)
 	return predict_label;
 }
 
-double RelocalizationJudger::NewJudger(const svm_node * eigenVec)
+double RelocalizationJudger::Judge(const double * eigenVec)
 {
-	return svm_predict(mJudgerModel.svmModel, eigenVec);
+	// Every thread normalizes and predicts with its own context and nodes, one per
+	// judger, created again only when that judger gets a new model. After the first
+	// call of a thread on a judger, a call neither allocates nor locks
+	struct JudgeContext {
+		JudgeContext() = default;
+		JudgeContext(const JudgeContext &) = delete;
+		~JudgeContext() { svm_predict_context_free(context); }
+		svm_predict_context *context = nullptr;
+		vector<svm_node> node;
+		uint64_t generation = 0;
+	};
+	thread_local unordered_map<const RelocalizationJudger *, JudgeContext> threadContexts;
+	JudgeContext &threadContext = threadContexts[this];
+
+	if (threadContext.generation != mJudgerModel.generation) {
+		svm_predict_context_free(threadContext.context);
+		threadContext.context = svm_predict_context_create(mJudgerModel.svmModel);
+		threadContext.node.resize(mNumOfEigenElem + 1);
+		threadContext.generation = mJudgerModel.generation;
+	}
+	NormalizeEigenVector(eigenVec, threadContext.node.data());
+	return svm_predict_with_context(threadContext.context, threadContext.node.data());
 }
 
 void RelocalizationJudger::PredictAndAnalysis(const string path)
@@ -644,6 +961,25 @@ void RelocalizationJudger::PredictAndAnalysis(const string path)
 		fprintf(predictDataFile, ",");
 	}
 	fprintf(predictDataFile, "real_value,old_predict_value,old_outliers,real_value,new_predict_value,new_outliers\n");
+
+	// New judger predicts the whole test set in one batch
+	vector<double> newPredicts(mTestSVMProb.l);
+	svm_predict_batch(mJudgerModel.svmModel, mTestSVMProb.x, mTestSVMProb.l, newPredicts.data());
+
+	// The single sample entry point must agree with the batch, from raw eigen vectors
+	size_t numOfJudgeDiffs = 0;
+	vector<double> rawEigenVec(mNumOfEigenElem);
+	for (size_t i = 0; i < mTestEigenSpaceLen; i++) {
+		for (size_t j = 0; j < mNumOfEigenElem; j++) {
+			rawEigenVec[j] = mTestEigenSpace[i][j].value;
+		}
+		if (Judge(rawEigenVec.data()) != newPredicts[i]) {
+			numOfJudgeDiffs++;
+		}
+	}
+	if (numOfJudgeDiffs > 0) {
+		cout << "PredictAndAnalysis(): Judge() differs from the batch prediction on " << numOfJudgeDiffs << " samples!" << endl;
+	}
 	
 	for (size_t i = 0; i < mTestEigenSpaceLen; i++) {
 		// Output eigen vector
@@ -654,7 +990,7 @@ void RelocalizationJudger::PredictAndAnalysis(const string path)
 		// Predict
 		double oldPredict = 0, newPredict = 0;
 		oldPredict = OldJudger(mTestEigenSpace[i]);
-		newPredict = NewJudger(mTestSVMProb.x[i]);
+		newPredict = newPredicts[i];
 
 		// Analysis and output results
 		// Old judger
@@ -720,6 +1056,78 @@ void RelocalizationJudger::PredictAndAnalysis(const string path)
 	fprintf(analysisResultFile, "TN = %d\n", newTN.size());
 	fprintf(analysisResultFile, "Accuracy = %g%s\n", (double)newCorrect / total * 100, "%");
 
+	// Same params with float feature rows, to see what they cost in accuracy.
+	// It trains a second model (with Platt CV if probability is on), so it is off by default
+	if (mCompareFloatStorageCfg) {
+		svm_parameter floatParam = mSVMParam;
+		floatParam.float_storage = 1;
+		svm_model *floatModel = svm_train(&mTrainSVMProb, &floatParam);
+		vector<double> floatPredicts(mTestSVMProb.l);
+		svm_predict_batch(floatModel, mTestSVMProb.x, mTestSVMProb.l, floatPredicts.data());
+
+		size_t floatCorrect = 0, numOfDiffs = 0;
+		size_t floatTP = 0, floatFP = 0, floatFN = 0, floatTN = 0;
+		for (int i = 0; i < mTestSVMProb.l; i++) {
+			double real = mTestSVMProb.y[i];
+			double floatPredict = floatPredicts[i];
+			if (floatPredict == real)
+				floatCorrect++;
+			if (floatPredict != newPredicts[i])
+				numOfDiffs++;
+			if ((floatPredict == 1) && (real == 1))
+				floatTP++;
+			if ((floatPredict == 1) && (real == 0))
+				floatFP++;
+			if ((floatPredict == 0) && (real == 1))
+				floatFN++;
+			if ((floatPredict == 0) && (real == 0))
+				floatTN++;
+		}
+
+		fprintf(analysisResultFile, "\n");
+		fprintf(analysisResultFile, "************ float storage judger predict result ************\n");
+		fprintf(analysisResultFile, "TP = %zu\n", floatTP);
+		fprintf(analysisResultFile, "FP = %zu\n", floatFP);
+		fprintf(analysisResultFile, "FN = %zu\n", floatFN);
+		fprintf(analysisResultFile, "TN = %zu\n", floatTN);
+		fprintf(analysisResultFile, "Accuracy = %g%s\n", (double)floatCorrect / mTestSVMProb.l * 100, "%");
+		fprintf(analysisResultFile, "Differ from new judger = %zu\n", numOfDiffs);
+
+		svm_free_and_destroy_model(&floatModel);
+	}
+
+	// Accuracy of the full model reduced to fewer and fewer support vectors
+	if (mJudgerModel.fullSvmModel) {
+		const svm_model *fullModel = mJudgerModel.fullSvmModel;
+		vector<double> fullPredicts(mTestSVMProb.l);
+		svm_predict_batch(fullModel, mTestSVMProb.x, mTestSVMProb.l, fullPredicts.data());
+
+		fprintf(analysisResultFile, "\n");
+		fprintf(analysisResultFile, "************ reduced judger predict result ************\n");
+		fprintf(analysisResultFile, "Exported judger has %d of %d SVs\n", mJudgerModel.svmModel->l, fullModel->l);
+		fprintf(analysisResultFile, "SVs,Accuracy,Max decision value change,Differ from full judger\n");
+		for (int numOfSV = fullModel->l; numOfSV >= 8; numOfSV /= 2) {
+			double loss = 0;
+			svm_model *reducedModel = (numOfSV == fullModel->l) ? nullptr :
+				svm_reduce_model(fullModel, numOfSV, HUGE_VAL, &loss);
+			const svm_model *model = reducedModel ? reducedModel : fullModel;
+			vector<double> reducedPredicts(mTestSVMProb.l);
+			svm_predict_batch(model, mTestSVMProb.x, mTestSVMProb.l, reducedPredicts.data());
+
+			size_t reducedCorrect = 0, numOfDiffs = 0;
+			for (int i = 0; i < mTestSVMProb.l; i++) {
+				if (reducedPredicts[i] == mTestSVMProb.y[i])
+					reducedCorrect++;
+				if (reducedPredicts[i] != fullPredicts[i])
+					numOfDiffs++;
+			}
+			fprintf(analysisResultFile, "%d,%g%s,%g,%zu\n", model->l,
+				(double)reducedCorrect / mTestSVMProb.l * 100, "%", loss, numOfDiffs);
+
+			svm_free_and_destroy_model(&reducedModel);
+		}
+	}
+
 	fclose(predictDataFile);
 	predictDataFile = nullptr;
 
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "svm/svm.h"
+#include "grid_search.h"
 #include "Python.h"
 #include <stdio.h>
 #include <ctype.h>
@@ -8,6 +9,7 @@
 #include <string.h>
 #include <vector>
 #include <mutex>
+#include <atomic>
 
 using namespace std;
 
@@ -15,10 +17,12 @@ using namespace std;
 
 struct JudgerModel {
 	svm_model *svmModel;
+	svm_model *fullSvmModel;		// 精简支持向量前的模型，未精简时为 nullptr
 	vector<string> eigenNames;
 	vector<double> eigenMeans;		// 训练集特征均值，用于对特征值归一化
 	vector<double> eigenStds;		// 训练集特征标准差，用于对特征值归一化
 	int32_t eigenRatio;				// 训练集特征归一化倍率，用于对特征值归一化
+	uint64_t generation;			// 每次训练递增，线程的预测上下文据此判断是否过期
 };
 
 class RelocalizationJudger {
@@ -26,6 +30,7 @@ class RelocalizationJudger {
 private:
 	static RelocalizationJudger * mInstance;
 	static mutex mInstanceMutex;
+	static atomic<uint64_t> mModelGeneration;	// 所有实例训练出的模型编号，不会重复
 	RelocalizationJudger();
 	~RelocalizationJudger();
 
@@ -34,6 +39,11 @@ public:
 	void ReleaseInstance();
 
 	/* Free and destory */
+private:
+	static svm_node ** NewNodeMatrix(size_t numOfRows, size_t rowSize, svm_node *&arena);
+	static void DeleteNodeMatrix(svm_node **&rows, svm_node *&arena);
+
+public:
 	void DestoryRawData();
 	void DestoryTrainSVMProb();
 	void DestoryTestSVMProb();
@@ -42,23 +52,27 @@ public:
 private:
 	const char * mPyFilePathCfg;
 	const char * mPyFileNameCfg;
+	const char * mAnalysisMidPathCfg;
 	const char * mPredictDataFileNameCfg;
+	const char * mGridSearchScoreFileNameCfg;
 	const char * mAnalysisResultFileNameCfg;
 	const char * mSetPyPathFunCfg;
+	const char * mSetDataFunCfg;
 	const char * mRunPyModuleFunCfg;
-	const char * mGetEigenNamesFunCfg;
-	const char * mGetEigenSpaceFunCfg;
-	const char * mGetLableFunCfg;
+	const char * mAnalyzeFunCfg;
 	const char * mGetTrainEigenFunCfg;
-	const char * mGetTrainEigenNormFunCfg;
 	const char * mGetTrainLableFunCfg;
 	const char * mGetTestEigenFunCfg;
-	const char * mGetTestEigenNormFunCfg;
 	const char * mGetTestLableFunCfg;
 	const char * mGetOriginalTestEigenFunCfg;
 	const char * mGetMeanAndStdFunCfg;
 	const char * mGetRatioFunCfg;
 	const char * mGetSVCParamFunCfg;
+	bool mHalvingSearchCfg;				// 参数搜索使用逐轮减半（更快，但可能选到不同的 C 和 gamma），默认穷举网格
+	bool mCompareFloatStorageCfg;		// 预测分析时再训练一个 float 特征的模型对比精度，要多训练一次，默认关闭
+	bool mDedupTrainSamplesCfg;			// 相同的(特征向量, 标签)训练样本只保留一个，重复次数作为样本权重；交叉验证按去重后的样本分折，默认关闭
+	int mReducedNumOfSVCfg;				// 训练后合并支持向量，最少精简到这个数目，导出的模型会变；0 表示不精简，默认不精简
+	double mReducedMaxLossCfg;			// 精简后任意输入的决策值变化上限
 
 	/* Python operate */
 private:
@@ -66,8 +80,11 @@ private:
 
 	void LoadPythonModule();
 	void SetPythonWorkPath(const string path);
+	void SetRawDataToPython();
 	void PythonTrainAndOptimize();
-	void GetRawDataFromPython();
+	void PythonAnalyze();
+	bool GetBufferFromPython(const char * funName, size_t numOfCols, Py_buffer &buffer);
+	void NormalizeEigenVector(const double * eigenVec, svm_node * node);
 	void GetTrainDataFromPython();
 	void GetTestDataFromPython();
 	void GetDataFromPython();
@@ -79,14 +96,21 @@ public:
 	void RunPythonModule(const string workPath);
 
 	/* Raw data */
+public:
+	void LoadRawData(const string workPath);
+
 private:
 	size_t mNumOfEigenElem;
+	bool mRawDataChanged;			// 数据集与缓存相比是否有变化
 	double *mRawLabel;
 	struct svm_node **mRawEigenSpace;
+	struct svm_node *mRawEigenSpaceArena;		// 所有行共用一块连续内存
 	size_t mRawEigenSpaceLen;
 	struct svm_node **mTrainEigenSpace;
+	struct svm_node *mTrainEigenSpaceArena;
 	size_t mTrainEigenSpaceLen;
 	struct svm_node **mTestEigenSpace;
+	struct svm_node *mTestEigenSpaceArena;
 	size_t mTestEigenSpaceLen;
 
 	/* SVM operate */
@@ -94,9 +118,14 @@ private:
 	svm_parameter mSVMParam;		// SVM参数
 	svm_problem mTrainSVMProb;		// 训练集
 	svm_problem mTestSVMProb;		// 测试集
+	svm_node *mTrainSVMProbArena;
+	svm_node *mTestSVMProbArena;
 	size_t mTrainEigenSpaceNormLen;
 	size_t mTestEigenSpaceNormLen;
 
+	void SearchSVMParam(const string path);
+	void ReduceSVMModel();
+
 public:
 	void RunSVMModule();
 
@@ -106,12 +135,14 @@ private:
 
 public:
 	void SaveJudgerModel(const string path);
+	void SaveJudgerPredictor(const string path);	// 生成编译期常量的预测器头文件
 
 	/* Predict and analysis */
 private:
 	double OldJudger(const svm_node * eigenVec);
-	double NewJudger(const svm_node * eigenVec);
 
 public:
+	// 判断一个未归一化的特征向量，可在多个线程中同时调用，但不能与 RunSVMModule 同时调用
+	double Judge(const double * eigenVec);
 	void PredictAndAnalysis(const string path);
 };
@@ -0,0 +1,376 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernel_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SVM_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SVM_TARGET_AVX2
+#define SVM_TARGET_AVX512
+#else
+#define SVM_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SVM_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+void rbf_rows_scalar(const double *x, const double * const *rows, int dim,
+		     double gamma, int n, double *out)
+{
+	for(int j=0;j<n;j++)
+	{
+		const double *y = rows[j];
+		double sum = 0;
+		for(int k=0;k<dim;k++)
+		{
+			double d = x[k] - y[k];
+			sum += d*d;
+		}
+		out[j] = exp(-gamma*sum);
+	}
+}
+
+void rbf_rows_float_scalar(const float *x, const float * const *rows, int dim,
+			   double gamma, int n, double *out)
+{
+	for(int j=0;j<n;j++)
+	{
+		const float *y = rows[j];
+		double sum = 0;
+		for(int k=0;k<dim;k++)
+		{
+			double d = (double)x[k] - (double)y[k];
+			sum += d*d;
+		}
+		out[j] = exp(-gamma*sum);
+	}
+}
+
+void rbf_cols_scalar(const double *x, const double *cols, int ld, int dim,
+		     double xx, const double *sq, double gamma, int n, double *out)
+{
+	for(int j=0;j<n;j++)
+	{
+		double dot = 0;
+		for(int k=0;k<dim;k++)
+			dot += x[k]*cols[(size_t)k*ld+j];
+		double d = xx + sq[j] - 2*dot;
+		out[j] = exp(-gamma*(d < 0 ? 0 : d));	// NaN stays NaN
+	}
+}
+
+#ifdef SVM_SIMD_X86
+
+//
+// exp(v) for v in [-708,0]: v = k*ln2 + r, |r| <= ln2/2, exp(r) by a degree 12
+// Taylor polynomial (relative error < 1e-15) and 2^k built in the exponent bits.
+// max(lower,v) returns v when it is NaN, so NaN propagates like in exp().
+//
+#define EXP_LOWER	-708.0
+#define EXP_LOG2E	1.4426950408889634074
+#define EXP_LN2_HI	6.93145751953125e-1
+#define EXP_LN2_LO	1.42860682030941723212e-6
+#define EXP_MAGIC	6755399441055744.0	// 1.5*2^52, rounds to integer when added
+
+static const double exp_coef[13] =
+{
+	1.0/479001600, 1.0/39916800, 1.0/3628800, 1.0/362880, 1.0/40320, 1.0/5040,
+	1.0/720, 1.0/120, 1.0/24, 1.0/6, 1.0/2, 1.0, 1.0
+};
+
+SVM_TARGET_AVX2 static inline __m256d exp_avx2(__m256d v)
+{
+	v = _mm256_max_pd(_mm256_set1_pd(EXP_LOWER),v);
+	__m256d t = _mm256_fmadd_pd(v,_mm256_set1_pd(EXP_LOG2E),_mm256_set1_pd(EXP_MAGIC));
+	__m256d kd = _mm256_sub_pd(t,_mm256_set1_pd(EXP_MAGIC));
+	__m256d r = _mm256_fnmadd_pd(kd,_mm256_set1_pd(EXP_LN2_HI),v);
+	r = _mm256_fnmadd_pd(kd,_mm256_set1_pd(EXP_LN2_LO),r);
+
+	__m256d p = _mm256_set1_pd(exp_coef[0]);
+	for(int c=1;c<13;c++)
+		p = _mm256_fmadd_pd(p,r,_mm256_set1_pd(exp_coef[c]));
+
+	__m256i k = _mm256_sub_epi64(_mm256_castpd_si256(t),_mm256_castpd_si256(_mm256_set1_pd(EXP_MAGIC)));
+	__m256i e = _mm256_slli_epi64(_mm256_add_epi64(k,_mm256_set1_epi64x(1023)),52);
+	return _mm256_mul_pd(p,_mm256_castsi256_pd(e));
+}
+
+SVM_TARGET_AVX2 static void rbf_rows_avx2(const double *x, const double * const *rows, int dim,
+					  double gamma, int n, double *out)
+{
+	__m256d neg_gamma = _mm256_set1_pd(-gamma);
+	for(int j=0;j<n;j+=4)
+	{
+		// pad the tail group with the last row
+		const double *r0 = rows[j];
+		const double *r1 = rows[j+1 < n ? j+1 : n-1];
+		const double *r2 = rows[j+2 < n ? j+2 : n-1];
+		const double *r3 = rows[j+3 < n ? j+3 : n-1];
+
+		__m256d sum = _mm256_setzero_pd();
+		for(int k=0;k<dim;k++)
+		{
+			__m256d d = _mm256_sub_pd(_mm256_set1_pd(x[k]),_mm256_set_pd(r3[k],r2[k],r1[k],r0[k]));
+			sum = _mm256_fmadd_pd(d,d,sum);
+		}
+		__m256d value = exp_avx2(_mm256_mul_pd(neg_gamma,sum));
+
+		if(j+4 <= n)
+			_mm256_storeu_pd(out+j,value);
+		else
+		{
+			double tail[4];
+			_mm256_storeu_pd(tail,value);
+			memcpy(out+j,tail,sizeof(double)*(n-j));
+		}
+	}
+}
+
+SVM_TARGET_AVX2 static void rbf_rows_float_avx2(const float *x, const float * const *rows, int dim,
+						double gamma, int n, double *out)
+{
+	__m256d neg_gamma = _mm256_set1_pd(-gamma);
+	for(int j=0;j<n;j+=4)
+	{
+		const float *r0 = rows[j];
+		const float *r1 = rows[j+1 < n ? j+1 : n-1];
+		const float *r2 = rows[j+2 < n ? j+2 : n-1];
+		const float *r3 = rows[j+3 < n ? j+3 : n-1];
+
+		__m256d sum = _mm256_setzero_pd();
+		for(int k=0;k<dim;k++)
+		{
+			__m256d y = _mm256_set_pd((double)r3[k],(double)r2[k],(double)r1[k],(double)r0[k]);
+			__m256d d = _mm256_sub_pd(_mm256_set1_pd((double)x[k]),y);
+			sum = _mm256_fmadd_pd(d,d,sum);
+		}
+		__m256d value = exp_avx2(_mm256_mul_pd(neg_gamma,sum));
+
+		if(j+4 <= n)
+			_mm256_storeu_pd(out+j,value);
+		else
+		{
+			double tail[4];
+			_mm256_storeu_pd(tail,value);
+			memcpy(out+j,tail,sizeof(double)*(n-j));
+		}
+	}
+}
+
+SVM_TARGET_AVX2 static void rbf_cols_avx2(const double *x, const double *cols, int ld, int dim,
+					  double xx, const double *sq, double gamma, int n, double *out)
+{
+	__m256d neg_gamma = _mm256_set1_pd(-gamma);
+	__m256d vxx = _mm256_set1_pd(xx);
+	for(int j=0;j<n;j+=4)
+	{
+		// lanes past n load zeros and are not stored
+		int rest = n-j;
+		__m256i mask = _mm256_set_epi64x(rest > 3 ? -1 : 0,rest > 2 ? -1 : 0,rest > 1 ? -1 : 0,-1);
+		__m256d dot = _mm256_setzero_pd();
+		for(int k=0;k<dim;k++)
+			dot = _mm256_fmadd_pd(_mm256_set1_pd(x[k]),_mm256_maskload_pd(cols+(size_t)k*ld+j,mask),dot);
+		__m256d d = _mm256_fnmadd_pd(_mm256_set1_pd(2.0),dot,_mm256_add_pd(vxx,_mm256_maskload_pd(sq+j,mask)));
+		__m256d value = exp_avx2(_mm256_mul_pd(neg_gamma,_mm256_max_pd(_mm256_setzero_pd(),d)));
+		_mm256_maskstore_pd(out+j,mask,value);
+	}
+}
+
+SVM_TARGET_AVX512 static inline __m512d exp_avx512(__m512d v)
+{
+	// the maskz forms with a full mask avoid the undefined source of the plain
+	// intrinsics, which GCC 12 reports as maybe uninitialized
+	v = _mm512_maskz_max_pd(0xff,_mm512_set1_pd(EXP_LOWER),v);
+	__m512d t = _mm512_fmadd_pd(v,_mm512_set1_pd(EXP_LOG2E),_mm512_set1_pd(EXP_MAGIC));
+	__m512d kd = _mm512_sub_pd(t,_mm512_set1_pd(EXP_MAGIC));
+	__m512d r = _mm512_fnmadd_pd(kd,_mm512_set1_pd(EXP_LN2_HI),v);
+	r = _mm512_fnmadd_pd(kd,_mm512_set1_pd(EXP_LN2_LO),r);
+
+	__m512d p = _mm512_set1_pd(exp_coef[0]);
+	for(int c=1;c<13;c++)
+		p = _mm512_fmadd_pd(p,r,_mm512_set1_pd(exp_coef[c]));
+
+	__m512i k = _mm512_sub_epi64(_mm512_castpd_si512(t),_mm512_castpd_si512(_mm512_set1_pd(EXP_MAGIC)));
+	__m512i e = _mm512_maskz_slli_epi64(0xff,_mm512_add_epi64(k,_mm512_set1_epi64(1023)),52);
+	return _mm512_mul_pd(p,_mm512_castsi512_pd(e));
+}
+
+SVM_TARGET_AVX512 static void rbf_rows_avx512(const double *x, const double * const *rows, int dim,
+					      double gamma, int n, double *out)
+{
+	__m512d neg_gamma = _mm512_set1_pd(-gamma);
+	for(int j=0;j<n;j+=8)
+	{
+		const double *r[8];
+		for(int t=0;t<8;t++)
+			r[t] = rows[j+t < n ? j+t : n-1];
+
+		__m512d sum = _mm512_setzero_pd();
+		for(int k=0;k<dim;k++)
+		{
+			__m512d y = _mm512_set_pd(r[7][k],r[6][k],r[5][k],r[4][k],r[3][k],r[2][k],r[1][k],r[0][k]);
+			__m512d d = _mm512_sub_pd(_mm512_set1_pd(x[k]),y);
+			sum = _mm512_fmadd_pd(d,d,sum);
+		}
+		__m512d value = exp_avx512(_mm512_mul_pd(neg_gamma,sum));
+
+		if(j+8 <= n)
+			_mm512_storeu_pd(out+j,value);
+		else
+		{
+			double tail[8];
+			_mm512_storeu_pd(tail,value);
+			memcpy(out+j,tail,sizeof(double)*(n-j));
+		}
+	}
+}
+
+SVM_TARGET_AVX512 static void rbf_rows_float_avx512(const float *x, const float * const *rows, int dim,
+						    double gamma, int n, double *out)
+{
+	__m512d neg_gamma = _mm512_set1_pd(-gamma);
+	for(int j=0;j<n;j+=8)
+	{
+		const float *r[8];
+		for(int t=0;t<8;t++)
+			r[t] = rows[j+t < n ? j+t : n-1];
+
+		__m512d sum = _mm512_setzero_pd();
+		for(int k=0;k<dim;k++)
+		{
+			__m512d y = _mm512_set_pd((double)r[7][k],(double)r[6][k],(double)r[5][k],(double)r[4][k],
+						  (double)r[3][k],(double)r[2][k],(double)r[1][k],(double)r[0][k]);
+			__m512d d = _mm512_sub_pd(_mm512_set1_pd((double)x[k]),y);
+			sum = _mm512_fmadd_pd(d,d,sum);
+		}
+		__m512d value = exp_avx512(_mm512_mul_pd(neg_gamma,sum));
+
+		if(j+8 <= n)
+			_mm512_storeu_pd(out+j,value);
+		else
+		{
+			double tail[8];
+			_mm512_storeu_pd(tail,value);
+			memcpy(out+j,tail,sizeof(double)*(n-j));
+		}
+	}
+}
+
+SVM_TARGET_AVX512 static void rbf_cols_avx512(const double *x, const double *cols, int ld, int dim,
+					      double xx, const double *sq, double gamma, int n, double *out)
+{
+	__m512d neg_gamma = _mm512_set1_pd(-gamma);
+	__m512d vxx = _mm512_set1_pd(xx);
+	for(int j=0;j<n;j+=8)
+	{
+		__mmask8 mask = (__mmask8)(j+8 <= n ? 0xff : (1u<<(n-j))-1);
+		__m512d dot = _mm512_setzero_pd();
+		for(int k=0;k<dim;k++)
+			dot = _mm512_fmadd_pd(_mm512_set1_pd(x[k]),_mm512_maskz_loadu_pd(mask,cols+(size_t)k*ld+j),dot);
+		__m512d d = _mm512_fnmadd_pd(_mm512_set1_pd(2.0),dot,_mm512_add_pd(vxx,_mm512_maskz_loadu_pd(mask,sq+j)));
+		__m512d value = exp_avx512(_mm512_mul_pd(neg_gamma,_mm512_maskz_max_pd(0xff,_mm512_setzero_pd(),d)));
+		_mm512_mask_storeu_pd(out+j,mask,value);
+	}
+}
+
+static bool cpu_supports(const char *feature)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info,0);
+	if(info[0] < 7)
+		return false;
+	__cpuid(info,1);
+	bool osxsave = (info[2] & (1<<27)) != 0;
+	bool fma = (info[2] & (1<<12)) != 0;
+	if(!osxsave)
+		return false;
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info,7,0);
+	if(strcmp(feature,"avx2") == 0)
+		return fma && (info[1] & (1<<5)) && (xcr0 & 0x6) == 0x6;
+	if(strcmp(feature,"avx512f") == 0)
+		return (info[1] & (1<<16)) && (xcr0 & 0xe6) == 0xe6;
+	return false;
+#else
+	__builtin_cpu_init();
+	if(strcmp(feature,"avx2") == 0)
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if(strcmp(feature,"avx512f") == 0)
+		return __builtin_cpu_supports("avx512f");
+	return false;
+#endif
+}
+
+#endif /* SVM_SIMD_X86 */
+
+struct rbf_table
+{
+	rbf_rows_function rows;
+	rbf_cols_function cols;
+	rbf_rows_float_function rows_float;
+	const char *name;
+};
+
+static rbf_table select_rbf_functions()
+{
+	const char *force = getenv("SVM_SIMD");
+	rbf_table best;
+	best.rows = &rbf_rows_scalar;
+	best.cols = &rbf_cols_scalar;
+	best.rows_float = &rbf_rows_float_scalar;
+	best.name = "scalar";
+
+#ifdef SVM_SIMD_X86
+	if(force == NULL || strcmp(force,"scalar") != 0)
+	{
+		bool want_avx512 = (force == NULL || strcmp(force,"avx512") == 0);
+		if(want_avx512 && cpu_supports("avx512f"))
+		{
+			best.rows = &rbf_rows_avx512;
+			best.cols = &rbf_cols_avx512;
+			best.rows_float = &rbf_rows_float_avx512;
+			best.name = "avx512";
+		}
+		else if(cpu_supports("avx2"))
+		{
+			best.rows = &rbf_rows_avx2;
+			best.cols = &rbf_cols_avx2;
+			best.rows_float = &rbf_rows_float_avx2;
+			best.name = "avx2";
+		}
+	}
+#else
+	(void)force;
+#endif
+	return best;
+}
+
+// selected on the first call from any thread, the initialization of a local static is thread safe
+static const rbf_table& get_rbf_table()
+{
+	static const rbf_table table = select_rbf_functions();
+	return table;
+}
+
+rbf_rows_function get_rbf_rows_function()
+{
+	return get_rbf_table().rows;
+}
+
+rbf_rows_float_function get_rbf_rows_float_function()
+{
+	return get_rbf_table().rows_float;
+}
+
+rbf_cols_function get_rbf_cols_function()
+{
+	return get_rbf_table().cols;
+}
+
+const char *get_rbf_rows_name()
+{
+	return get_rbf_table().name;
+}
@@ -0,0 +1,45 @@
+#ifndef _LIBSVM_KERNEL_SIMD_H
+#define _LIBSVM_KERNEL_SIMD_H
+
+//
+// Batched RBF kernel rows for dense data
+//
+// out[j] = exp(-gamma*|x-rows[j]|^2) for j = 0,...,n-1, every row has dim features.
+// The vectorized versions process rows in groups of 4 (AVX2) or 8 (AVX-512) and
+// pad the tail group, so the value of a row never depends on where a batch starts.
+//
+typedef void (*rbf_rows_function)(const double *x, const double * const *rows, int dim,
+				  double gamma, int n, double *out);
+
+void rbf_rows_scalar(const double *x, const double * const *rows, int dim,
+		     double gamma, int n, double *out);
+
+// same for rows stored as float, the differences are taken and summed in double
+typedef void (*rbf_rows_float_function)(const float *x, const float * const *rows, int dim,
+					double gamma, int n, double *out);
+
+void rbf_rows_float_scalar(const float *x, const float * const *rows, int dim,
+			   double gamma, int n, double *out);
+
+//
+// RBF kernel values against a transposed block of rows
+//
+// out[j] = exp(-gamma*max(xx+sq[j]-2*x.y_j,0)) for j = 0,...,n-1, where feature k
+// of y_j is cols[k*ld+j], xx = |x|^2 and sq[j] = |y_j|^2. The dot products are a
+// GEMM style axpy over contiguous columns, so a block of rows is read once per
+// sample and the kernel values are finished in registers.
+//
+typedef void (*rbf_cols_function)(const double *x, const double *cols, int ld, int dim,
+				  double xx, const double *sq, double gamma, int n, double *out);
+
+void rbf_cols_scalar(const double *x, const double *cols, int ld, int dim,
+		     double xx, const double *sq, double gamma, int n, double *out);
+
+// best implementation supported by this cpu, chosen once from cpuid;
+// set SVM_SIMD=scalar|avx2|avx512 to force a path
+rbf_rows_function get_rbf_rows_function();
+rbf_rows_float_function get_rbf_rows_float_function();
+rbf_cols_function get_rbf_cols_function();
+const char *get_rbf_rows_name();
+
+#endif /* _LIBSVM_KERNEL_SIMD_H */
@@ -8,6 +8,9 @@
 #include <limits.h>
 #include <locale.h>
 #include "svm.h"
+#include "kernel_simd.h"
+#include "svm_parallel.h"
+#include "svm_memory.h"
 int libsvm_version = LIBSVM_VERSION;
 typedef float Qfloat;
 typedef signed char schar;
@@ -75,35 +78,64 @@ public:
 	// (p >= len if nothing needs to be filled)
 	int get_data(const int index, Qfloat **data, int len);
 	void swap_index(int i, int j);
+	void get_stats(long int *hit, long int *miss) const { *hit = nr_hit; *miss = nr_miss; }
 private:
 	int l;
-	long int size;
+	int nr_slot;		// columns that fit, each slot holds l Qfloats
+	Qfloat *slab;		// nr_slot*l Qfloats, allocated once
+	int *free_slot;		// stack of unused slots
+	int nr_free;
+	long int nr_hit, nr_miss;
+
 	struct head_t
 	{
 		head_t *prev, *next;	// a circular list
-		Qfloat *data;
+		int slot;		// -1 if not cached, otherwise the entry is in the lru list
 		int len;		// data[0,len) is cached in this entry
+		int synced;		// swap_log[0,synced) has been applied to data
 	};
 
 	head_t *head;
 	head_t lru_head;
 	void lru_delete(head_t *h);
 	void lru_insert(head_t *h);
+
+	// swaps are not applied to every cached column at once: they are logged and
+	// each column replays the ones it missed when it is used again
+	struct swap_t { int i, j; };
+	swap_t *swap_log;
+	int log_len, log_max;
+	void sync(head_t *h);
+	void flush_log();
 };
 
-Cache::Cache(int l_,long int size_):l(l_),size(size_)
+Cache::Cache(int l_,long int size):l(l_)
 {
 	head = (head_t *)calloc(l,sizeof(head_t));	// initialized to 0
+	for(int i=0;i<l;i++)
+		head[i].slot = -1;
 	size /= sizeof(Qfloat);
-	size -= l * sizeof(head_t) / sizeof(Qfloat);
+	size -= l * (sizeof(head_t) + sizeof(int)) / sizeof(Qfloat);
 	size = max(size, 2 * (long int) l);	// cache must be large enough for two columns
+	nr_slot = (int)min(size / max(l,1), (long int) l);
+	nr_slot = max(nr_slot, min(2,l));
+	slab = (Qfloat *)svm_alloc_large(sizeof(Qfloat)*(size_t)nr_slot*l);
+	free_slot = Malloc(int,max(nr_slot,1));
+	for(int s=0;s<nr_slot;s++)
+		free_slot[s] = nr_slot-1-s;
+	nr_free = nr_slot;
+	nr_hit = nr_miss = 0;
 	lru_head.next = lru_head.prev = &lru_head;
+	log_max = max(l,16);
+	swap_log = Malloc(swap_t,log_max);
+	log_len = 0;
 }
 
 Cache::~Cache()
 {
-	for(head_t *h = lru_head.next; h != &lru_head; h=h->next)
-		free(h->data);
+	svm_free_large(slab);
+	free(free_slot);
+	free(swap_log);
 	free(head);
 }
 
@@ -123,33 +155,65 @@ void Cache::lru_insert(head_t *h)
 	h->next->prev = h;
 }
 
+void Cache::sync(head_t *h)
+{
+	Qfloat *data = slab + (size_t)h->slot*l;
+	for(int k=h->synced;k<log_len;k++)
+	{
+		int i = swap_log[k].i, j = swap_log[k].j;
+		if(h->len > j)
+			swap(data[i],data[j]);
+		else if(h->len > i)
+			h->len = i;		// row j is not cached, keep the rows before i
+	}
+	h->synced = log_len;
+}
+
+void Cache::flush_log()
+{
+	for(head_t *h = lru_head.next; h != &lru_head; h=h->next)
+		sync(h);
+	log_len = 0;
+	for(head_t *h = lru_head.next; h != &lru_head; h=h->next)
+		h->synced = 0;
+}
+
 int Cache::get_data(const int index, Qfloat **data, int len)
 {
 	head_t *h = &head[index];
-	if(h->len) lru_delete(h);
-	int more = len - h->len;
+	if(h->slot >= 0)
+	{
+		lru_delete(h);
+		sync(h);
+	}
 
-	if(more > 0)
+	if(h->slot < 0)
 	{
-		// free old space
-		while(size < more)
+		if(nr_free == 0)
 		{
+			// take the slot of the least recently used column
 			head_t *old = lru_head.next;
 			lru_delete(old);
-			free(old->data);
-			size += old->len;
-			old->data = 0;
+			free_slot[nr_free++] = old->slot;
+			old->slot = -1;
 			old->len = 0;
 		}
+		h->slot = free_slot[--nr_free];
+		h->len = 0;
+		h->synced = log_len;
+	}
 
-		// allocate new space
-		h->data = (Qfloat *)realloc(h->data,sizeof(Qfloat)*len);
-		size -= more;
+	int more = len - h->len;
+	if(more > 0)
+	{
 		swap(h->len,len);
+		++nr_miss;
 	}
+	else
+		++nr_hit;
 
 	lru_insert(h);
-	*data = h->data;
+	*data = slab + (size_t)h->slot*l;
 	return len;
 }
 
@@ -157,31 +221,20 @@ void Cache::swap_index(int i, int j)
 {
 	if(i==j) return;
 
-	if(head[i].len) lru_delete(&head[i]);
-	if(head[j].len) lru_delete(&head[j]);
-	swap(head[i].data,head[j].data);
+	if(head[i].slot >= 0) lru_delete(&head[i]);
+	if(head[j].slot >= 0) lru_delete(&head[j]);
+	swap(head[i].slot,head[j].slot);
 	swap(head[i].len,head[j].len);
-	if(head[i].len) lru_insert(&head[i]);
-	if(head[j].len) lru_insert(&head[j]);
+	swap(head[i].synced,head[j].synced);
+	if(head[i].slot >= 0) lru_insert(&head[i]);
+	if(head[j].slot >= 0) lru_insert(&head[j]);
 
 	if(i>j) swap(i,j);
-	for(head_t *h = lru_head.next; h!=&lru_head; h=h->next)
-	{
-		if(h->len > i)
-		{
-			if(h->len > j)
-				swap(h->data[i],h->data[j]);
-			else
-			{
-				// give up
-				lru_delete(h);
-				free(h->data);
-				size += h->len;
-				h->data = 0;
-				h->len = 0;
-			}
-		}
-	}
+	if(log_len == log_max)
+		flush_log();
+	swap_log[log_len].i = i;
+	swap_log[log_len].j = j;
+	log_len++;
 }
 
 //
@@ -196,9 +249,116 @@ public:
 	virtual Qfloat *get_Q(int column, int len) const = 0;
 	virtual double *get_QD() const = 0;
 	virtual void swap_index(int i, int j) const = 0;
+	virtual int get_nr_thread() const { return 1; }
+	virtual void get_cache_stats(long int *hit, long int *miss) const { *hit = *miss = 0; }
 	virtual ~QMatrix() {}
 };
 
+//
+// Dense rows
+//
+// a row is dense if its indices are base,base+1,...,base+dim-1 followed by -1;
+// when every row of a problem is dense with the same base and dim, the kernel
+// keeps them as contiguous double arrays and skips the sparse index merge
+//
+static bool is_dense_row(const svm_node *px, int dim, int base)
+{
+	for(int k=0;k<dim;k++)
+		if(px[k].index != base+k)
+			return false;
+	return px[dim].index == -1;
+}
+
+static int get_dense_dim(const svm_node * const *x, int l, int *base)
+{
+	if(l <= 0 || x[0][0].index == -1)
+		return 0;
+	*base = x[0][0].index;
+	int dim = 0;
+	while(x[0][dim].index != -1)
+		++dim;
+	for(int i=1;i<l;i++)
+		if(!is_dense_row(x[i],dim,*base))
+			return 0;
+	return dim;
+}
+
+// rows may be stored as double or float, the sums are always taken in double
+template<class TX, class TY>
+static inline double dot_dense(const TX *px, const TY *py, int dim)
+{
+	double sum = 0;
+	for(int k=0;k<dim;k++)
+		sum += (double)px[k] * (double)py[k];
+	return sum;
+}
+
+template<class TX, class TY>
+static inline double dist2_dense(const TX *px, const TY *py, int dim)
+{
+	double sum = 0;
+	for(int k=0;k<dim;k++)
+	{
+		double d = (double)px[k] - (double)py[k];
+		sum += d*d;
+	}
+	return sum;
+}
+
+//
+// Precomputed kernel matrix
+//
+// Holds K for every pair of rows of a problem as Qfloat.  A Kernel built on
+// rows of that problem with the same kernel parameters reads its columns from
+// here; (Qfloat)(y_i*y_j*K_ij) is the same whether K_ij was rounded to Qfloat
+// before or not, so the results do not change.
+//
+struct svm_kernel_matrix
+{
+	int l;
+	int kernel_type;
+	int degree;
+	double gamma;
+	double coef0;
+	int float_storage;
+	Qfloat *data;		// data[i*l+j] = K(i,j)
+	struct row
+	{
+		const svm_node *x;
+		int index;
+	} *rows;		// sorted by x for lookups
+};
+
+static int compare_km_row(const void *a, const void *b)
+{
+	size_t x = (size_t)((const svm_kernel_matrix::row *)a)->x;
+	size_t y = (size_t)((const svm_kernel_matrix::row *)b)->x;
+	return (x > y) - (x < y);
+}
+
+static int km_find(const svm_kernel_matrix *km, const svm_node *x)
+{
+	int low = 0, high = km->l-1;
+	while(low <= high)
+	{
+		int mid = (low+high)/2;
+		if((size_t)km->rows[mid].x < (size_t)x)
+			low = mid+1;
+		else if((size_t)km->rows[mid].x > (size_t)x)
+			high = mid-1;
+		else
+			return km->rows[mid].index;
+	}
+	return -1;
+}
+
+static bool km_match(const svm_kernel_matrix *km, const svm_parameter& param)
+{
+	return km->kernel_type == param.kernel_type && km->degree == param.degree &&
+		km->gamma == param.gamma && km->coef0 == param.coef0 &&
+		km->float_storage == param.float_storage;
+}
+
 class Kernel: public QMatrix {
 public:
 	Kernel(int l, svm_node * const * x, const svm_parameter& param);
@@ -206,20 +366,41 @@ public:
 
 	static double k_function(const svm_node *x, const svm_node *y,
 				 const svm_parameter& param);
+	template<class TY>
+	static double k_function_dense(const double *x, const TY *y, int dim,
+				 const svm_parameter& param);
 	virtual Qfloat *get_Q(int column, int len) const = 0;
 	virtual double *get_QD() const = 0;
+	virtual int get_nr_thread() const { return nr_thread; }
 	virtual void swap_index(int i, int j) const	// no so const...
 	{
 		swap(x[i],x[j]);
 		if(x_square) swap(x_square[i],x_square[j]);
+		if(x_dense) swap(x_dense[i],x_dense[j]);
+		if(x_dense_f) swap(x_dense_f[i],x_dense_f[j]);
+		if(kernel_matrix_index) swap(kernel_matrix_index[i],kernel_matrix_index[j]);
 	}
 protected:
 
 	double (Kernel::*kernel_function)(int i, int j) const;
+	// K(i,j) for j in [start,end), returned in column[start,end)
+	const double *kernel_column(int i, int start, int end) const;
+	void fill_kernel_column(int i, int start, int end, double *out) const;
 
 private:
 	const svm_node **x;
 	double *x_square;
+	const double **x_dense;		// rows in x_dense_space, NULL if x is sparse
+	double *x_dense_space;
+	const float **x_dense_f;	// rows in x_dense_f_space instead for param.float_storage
+	float *x_dense_f_space;
+	int dim;
+	double *column;
+	rbf_rows_function rbf_rows;	// batched dense rbf, NULL if not applicable
+	rbf_rows_float_function rbf_rows_f;
+	int nr_thread;
+	const svm_kernel_matrix *kernel_matrix;
+	int *kernel_matrix_index;	// row of x[i] in kernel_matrix, NULL if not used
 
 	// svm_parameter
 	const int kernel_type;
@@ -248,34 +429,102 @@ private:
 	{
 		return x[i][(int)(x[j][0].value)].value;
 	}
+	double kernel_linear_dense(int i, int j) const
+	{
+		return dot_dense(x_dense[i],x_dense[j],dim);
+	}
+	double kernel_poly_dense(int i, int j) const
+	{
+		return powi(gamma*dot_dense(x_dense[i],x_dense[j],dim)+coef0,degree);
+	}
+	double kernel_rbf_dense(int i, int j) const
+	{
+		return exp(-gamma*dist2_dense(x_dense[i],x_dense[j],dim));
+	}
+	double kernel_sigmoid_dense(int i, int j) const
+	{
+		return tanh(gamma*dot_dense(x_dense[i],x_dense[j],dim)+coef0);
+	}
+	double kernel_linear_dense_f(int i, int j) const
+	{
+		return dot_dense(x_dense_f[i],x_dense_f[j],dim);
+	}
+	double kernel_poly_dense_f(int i, int j) const
+	{
+		return powi(gamma*dot_dense(x_dense_f[i],x_dense_f[j],dim)+coef0,degree);
+	}
+	double kernel_rbf_dense_f(int i, int j) const
+	{
+		return exp(-gamma*dist2_dense(x_dense_f[i],x_dense_f[j],dim));
+	}
+	double kernel_sigmoid_dense_f(int i, int j) const
+	{
+		return tanh(gamma*dot_dense(x_dense_f[i],x_dense_f[j],dim)+coef0);
+	}
 };
 
 Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 :kernel_type(param.kernel_type), degree(param.degree),
  gamma(param.gamma), coef0(param.coef0)
 {
+	clone(x,x_,l);
+
+	int base = 0;
+	dim = (kernel_type == PRECOMPUTED) ? 0 : get_dense_dim(x,l,&base);
+	x_dense_space = 0;
+	x_dense = 0;
+	x_dense_f_space = 0;
+	x_dense_f = 0;
+	if(dim > 0 && param.float_storage)
+	{
+		// half the bytes of the double rows per kernel value, on top of x
+		x_dense_f_space = (float *)svm_alloc_large(sizeof(float)*(size_t)l*dim);
+		x_dense_f = new const float *[l];
+		for(int i=0;i<l;i++)
+		{
+			float *row = &x_dense_f_space[(size_t)i*dim];
+			for(int k=0;k<dim;k++)
+				row[k] = (float)x[i][k].value;
+			x_dense_f[i] = row;
+		}
+	}
+	else if(dim > 0)
+	{
+		x_dense_space = (double *)svm_alloc_large(sizeof(double)*(size_t)l*dim);
+		x_dense = new const double *[l];
+		for(int i=0;i<l;i++)
+		{
+			double *row = &x_dense_space[(size_t)i*dim];
+			for(int k=0;k<dim;k++)
+				row[k] = x[i][k].value;
+			x_dense[i] = row;
+		}
+	}
+
 	switch(kernel_type)
 	{
 		case LINEAR:
-			kernel_function = &Kernel::kernel_linear;
+			kernel_function = x_dense ? &Kernel::kernel_linear_dense :
+				x_dense_f ? &Kernel::kernel_linear_dense_f : &Kernel::kernel_linear;
 			break;
 		case POLY:
-			kernel_function = &Kernel::kernel_poly;
+			kernel_function = x_dense ? &Kernel::kernel_poly_dense :
+				x_dense_f ? &Kernel::kernel_poly_dense_f : &Kernel::kernel_poly;
 			break;
 		case RBF:
-			kernel_function = &Kernel::kernel_rbf;
+			kernel_function = x_dense ? &Kernel::kernel_rbf_dense :
+				x_dense_f ? &Kernel::kernel_rbf_dense_f : &Kernel::kernel_rbf;
 			break;
 		case SIGMOID:
-			kernel_function = &Kernel::kernel_sigmoid;
+			kernel_function = x_dense ? &Kernel::kernel_sigmoid_dense :
+				x_dense_f ? &Kernel::kernel_sigmoid_dense_f : &Kernel::kernel_sigmoid;
 			break;
 		case PRECOMPUTED:
 			kernel_function = &Kernel::kernel_precomputed;
 			break;
 	}
 
-	clone(x,x_,l);
-
-	if(kernel_type == RBF)
+	if(kernel_type == RBF && dim == 0)
 	{
 		x_square = new double[l];
 		for(int i=0;i<l;i++)
@@ -283,12 +532,76 @@ Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 	}
 	else
 		x_square = 0;
+
+	column = new double[l];
+	rbf_rows = (kernel_type == RBF && x_dense) ? get_rbf_rows_function() : 0;
+	rbf_rows_f = (kernel_type == RBF && x_dense_f) ? get_rbf_rows_float_function() : 0;
+	nr_thread = svm_resolve_nr_thread(param.nr_thread);
+
+	kernel_matrix = 0;
+	kernel_matrix_index = 0;
+	if(param.kernel_matrix && km_match(param.kernel_matrix,param))
+	{
+		kernel_matrix_index = new int[l];
+		int i;
+		for(i=0;i<l;i++)
+			if((kernel_matrix_index[i] = km_find(param.kernel_matrix,x[i])) < 0)
+				break;
+		if(i == l)
+			kernel_matrix = param.kernel_matrix;
+		else
+		{
+			delete[] kernel_matrix_index;
+			kernel_matrix_index = 0;
+		}
+	}
 }
 
 Kernel::~Kernel()
 {
 	delete[] x;
 	delete[] x_square;
+	delete[] column;
+	delete[] kernel_matrix_index;
+	delete[] x_dense;
+	svm_free_large(x_dense_space);
+	delete[] x_dense_f;
+	svm_free_large(x_dense_f_space);
+}
+
+// columns shorter than two grains are filled by the calling thread
+#define KERNEL_COLUMN_GRAIN 2048
+
+const double *Kernel::kernel_column(int i, int start, int end) const
+{
+	fill_kernel_column(i,start,end,column);
+	return column;
+}
+
+void Kernel::fill_kernel_column(int i, int start, int end, double *out) const
+{
+	if(kernel_matrix_index)
+	{
+		const Qfloat *K_i = &kernel_matrix->data[(size_t)kernel_matrix_index[i]*kernel_matrix->l];
+		for(int j=start;j<end;j++)
+			out[j] = K_i[kernel_matrix_index[j]];
+		return;
+	}
+
+	// every value is computed on its own, so the split does not change the result
+	if(rbf_rows)
+		parallel_for(start,end,KERNEL_COLUMN_GRAIN,nr_thread,[this,i,out](int begin, int end) {
+			rbf_rows(x_dense[i],x_dense+begin,dim,gamma,end-begin,out+begin);
+		});
+	else if(rbf_rows_f)
+		parallel_for(start,end,KERNEL_COLUMN_GRAIN,nr_thread,[this,i,out](int begin, int end) {
+			rbf_rows_f(x_dense_f[i],x_dense_f+begin,dim,gamma,end-begin,out+begin);
+		});
+	else
+		parallel_for(start,end,KERNEL_COLUMN_GRAIN,nr_thread,[this,i,out](int begin, int end) {
+			for(int j=begin;j<end;j++)
+				out[j] = (this->*kernel_function)(i,j);
+		});
 }
 
 double Kernel::dot(const svm_node *px, const svm_node *py)
@@ -372,6 +685,25 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 	}
 }
 
+template<class TY>
+double Kernel::k_function_dense(const double *x, const TY *y, int dim,
+			  const svm_parameter& param)
+{
+	switch(param.kernel_type)
+	{
+		case LINEAR:
+			return dot_dense(x,y,dim);
+		case POLY:
+			return powi(param.gamma*dot_dense(x,y,dim)+param.coef0,param.degree);
+		case RBF:
+			return exp(-param.gamma*dist2_dense(x,y,dim));
+		case SIGMOID:
+			return tanh(param.gamma*dot_dense(x,y,dim)+param.coef0);
+		default:
+			return 0;  // Unreachable, precomputed kernel is never dense
+	}
+}
+
 // An SMO algorithm in Fan et al., JMLR 6(2005), p. 1889--1918
 // Solves:
 //
@@ -403,9 +735,18 @@ public:
 		double r;	// for Solver_NU
 	};
 
+	// gradient carried between solves of a regularization path, in the
+	// original order; with it Solve also puts Q back into the original order
+	struct WarmStart {
+		double *G;
+		double *G_bar;
+		bool valid;	// G and G_bar belong to the alpha passed in
+	};
+
+	// W_[i] scales the bound of alpha_i, NULL for none
 	void Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		   double *alpha_, double Cp, double Cn, double eps,
-		   SolutionInfo* si, int shrinking);
+		   SolutionInfo* si, int shrinking, WarmStart *ws = NULL, const double *W_ = NULL);
 protected:
 	int active_size;
 	schar *y;
@@ -417,6 +758,7 @@ protected:
 	const double *QD;
 	double eps;
 	double Cp,Cn;
+	double *W;		// instance weights, NULL if not weighted
 	double *p;
 	int *active_set;
 	double *G_bar;		// gradient, if we treat free variables as 0
@@ -425,7 +767,8 @@ protected:
 
 	double get_C(int i)
 	{
-		return (y[i] > 0)? Cp : Cn;
+		double C = (y[i] > 0)? Cp : Cn;
+		return W ? W[i]*C : C;
 	}
 	void update_alpha_status(int i)
 	{
@@ -440,6 +783,7 @@ protected:
 	bool is_free(int i) { return alpha_status[i] == FREE; }
 	void swap_index(int i, int j);
 	void reconstruct_gradient();
+	void add_columns(const int *cols, int n, int begin, int end, bool with_G_bar);
 	virtual int select_working_set(int &i, int &j);
 	virtual double calculate_rho();
 	virtual void do_shrinking();
@@ -457,6 +801,65 @@ void Solver::swap_index(int i, int j)
 	swap(p[i],p[j]);
 	swap(active_set[i],active_set[j]);
 	swap(G_bar[i],G_bar[j]);
+	if(W) swap(W[i],W[j]);
+}
+
+// columns are copied into blocks of at most this size, so that the cache may
+// evict them while a block is being accumulated
+#define GRADIENT_BLOCK_BYTES (8<<20)
+#define GRADIENT_GRAIN 2048
+
+// G[j] += alpha_i*Q_ij, and G_bar[j] += C_i*Q_ij for upper bound i if with_G_bar,
+// for i in cols[0..n) and j in [begin,end).  Threads own disjoint ranges of j and
+// add the columns in the serial order, so the sums are the same for any split.
+void Solver::add_columns(const int *cols, int n, int begin, int end, bool with_G_bar)
+{
+	int len = end - begin;
+	int nr_thread = Q->get_nr_thread();
+	if(n == 0 || len <= 0)
+		return;
+
+	if(nr_thread <= 1 || len < 2*GRADIENT_GRAIN)
+	{
+		for(int c=0;c<n;c++)
+		{
+			int i = cols[c];
+			const Qfloat *Q_i = Q->get_Q(i,end);
+			double alpha_i = alpha[i];
+			int j;
+			for(j=begin;j<end;j++)
+				G[j] += alpha_i*Q_i[j];
+			if(with_G_bar && is_upper_bound(i))
+				for(j=begin;j<end;j++)
+					G_bar[j] += get_C(i) * Q_i[j];
+		}
+		return;
+	}
+
+	int block_size = (int)min((size_t)n,max((size_t)1,GRADIENT_BLOCK_BYTES/(sizeof(Qfloat)*len)));
+	Qfloat *block = new Qfloat[(size_t)block_size*len];
+	for(int b=0;b<n;b+=block_size)
+	{
+		int nr_block = min(block_size,n-b);
+		for(int c=0;c<nr_block;c++)
+			memcpy(block+(size_t)c*len,Q->get_Q(cols[b+c],end)+begin,sizeof(Qfloat)*len);
+
+		parallel_for(begin,end,GRADIENT_GRAIN,nr_thread,[&](int j_begin, int j_end) {
+			for(int c=0;c<nr_block;c++)
+			{
+				int i = cols[b+c];
+				const Qfloat *Q_i = block+(size_t)c*len-begin;
+				double alpha_i = alpha[i];
+				int j;
+				for(j=j_begin;j<j_end;j++)
+					G[j] += alpha_i*Q_i[j];
+				if(with_G_bar && is_upper_bound(i))
+					for(j=j_begin;j<j_end;j++)
+						G_bar[j] += get_C(i) * Q_i[j];
+			}
+		});
+	}
+	delete[] block;
 }
 
 void Solver::reconstruct_gradient()
@@ -471,39 +874,60 @@ void Solver::reconstruct_gradient()
 	for(j=active_size;j<l;j++)
 		G[j] = G_bar[j] + p[j];
 
+	int *free_set = new int[active_size];
 	for(j=0;j<active_size;j++)
 		if(is_free(j))
-			nr_free++;
+			free_set[nr_free++] = j;
 
 	if(2*nr_free < active_size)
 		info("\nWARNING: using -h 0 may be faster\n");
 
 	if (nr_free*l > 2*active_size*(l-active_size))
 	{
-		for(i=active_size;i<l;i++)
+		// every inactive G[i] is a dot product with a row, rows run in parallel
+		int nr_thread = Q->get_nr_thread();
+		if(nr_thread <= 1)
 		{
-			const Qfloat *Q_i = Q->get_Q(i,active_size);
-			for(j=0;j<active_size;j++)
-				if(is_free(j))
-					G[i] += alpha[j] * Q_i[j];
-		}
-	}
-	else
-	{
-		for(i=0;i<active_size;i++)
-			if(is_free(i))
+			for(i=active_size;i<l;i++)
 			{
-				const Qfloat *Q_i = Q->get_Q(i,l);
-				double alpha_i = alpha[i];
-				for(j=active_size;j<l;j++)
-					G[j] += alpha_i * Q_i[j];
+				const Qfloat *Q_i = Q->get_Q(i,active_size);
+				for(j=0;j<nr_free;j++)
+					G[i] += alpha[free_set[j]] * Q_i[free_set[j]];
 			}
+			delete[] free_set;
+			return;
+		}
+		int block_size = (int)max((size_t)1,GRADIENT_BLOCK_BYTES/(sizeof(Qfloat)*active_size));
+		int grain = max(1,GRADIENT_GRAIN/max(nr_free,1));
+		Qfloat *block = new Qfloat[(size_t)min(block_size,l-active_size)*active_size];
+		for(int b=active_size;b<l;b+=block_size)
+		{
+			int nr_block = min(block_size,l-b);
+			for(int c=0;c<nr_block;c++)
+				memcpy(block+(size_t)c*active_size,Q->get_Q(b+c,active_size),sizeof(Qfloat)*active_size);
+
+			parallel_for(0,nr_block,grain,nr_thread,[&](int c_begin, int c_end) {
+				for(int c=c_begin;c<c_end;c++)
+				{
+					const Qfloat *Q_i = block+(size_t)c*active_size;
+					double sum = G[b+c];
+					for(int k=0;k<nr_free;k++)
+						sum += alpha[free_set[k]] * Q_i[free_set[k]];
+					G[b+c] = sum;
+				}
+			});
+		}
+		delete[] block;
 	}
+	else
+		add_columns(free_set,nr_free,active_size,l,false);
+
+	delete[] free_set;
 }
 
 void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		   double *alpha_, double Cp, double Cn, double eps,
-		   SolutionInfo* si, int shrinking)
+		   SolutionInfo* si, int shrinking, WarmStart *ws, const double *W_)
 {
 	this->l = l;
 	this->Q = &Q;
@@ -513,6 +937,9 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	clone(alpha,alpha_,l);
 	this->Cp = Cp;
 	this->Cn = Cn;
+	W = 0;
+	if(W_)
+		clone(W,W_,l);
 	this->eps = eps;
 	unshrink = false;
 
@@ -532,6 +959,12 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	}
 
 	// initialize gradient
+	if(ws && ws->valid)
+	{
+		clone(G,ws->G,l);
+		clone(G_bar,ws->G_bar,l);
+	}
+	else
 	{
 		G = new double[l];
 		G_bar = new double[l];
@@ -541,18 +974,13 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			G[i] = p[i];
 			G_bar[i] = 0;
 		}
+		int *nonzero_set = new int[l];
+		int nr_nonzero = 0;
 		for(i=0;i<l;i++)
 			if(!is_lower_bound(i))
-			{
-				const Qfloat *Q_i = Q.get_Q(i,l);
-				double alpha_i = alpha[i];
-				int j;
-				for(j=0;j<l;j++)
-					G[j] += alpha_i*Q_i[j];
-				if(is_upper_bound(i))
-					for(j=0;j<l;j++)
-						G_bar[j] += get_C(i) * Q_i[j];
-			}
+				nonzero_set[nr_nonzero++] = i;
+		add_columns(nonzero_set,nr_nonzero,0,l,true);
+		delete[] nonzero_set;
 	}
 
 	// optimization step
@@ -761,17 +1189,26 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	}
 
 	// juggle everything back
-	/*{
+	if(ws)
+	{
+		for(int i=0;i<l;i++)
+		{
+			ws->G[active_set[i]] = G[i];
+			ws->G_bar[active_set[i]] = G_bar[i];
+		}
+		ws->valid = true;
 		for(int i=0;i<l;i++)
 			while(active_set[i] != i)
 				swap_index(i,active_set[i]);
-				// or Q.swap_index(i,active_set[i]);
-	}*/
+	}
 
 	si->upper_bound_p = Cp;
 	si->upper_bound_n = Cn;
 
 	info("\noptimization finished, #iter = %d\n",iter);
+	long int nr_hit, nr_miss;
+	Q.get_cache_stats(&nr_hit,&nr_miss);
+	info("kernel cache: %ld hits, %ld misses\n",nr_hit,nr_miss);
 
 	delete[] p;
 	delete[] y;
@@ -780,6 +1217,7 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	delete[] active_set;
 	delete[] G;
 	delete[] G_bar;
+	delete[] W;
 }
 
 // return 1 if already optimal, return 0 otherwise
@@ -1282,8 +1720,9 @@ public:
 		int start, j;
 		if((start = cache->get_data(i,&data,len)) < len)
 		{
+			const double *k_i = kernel_column(i,start,len);
 			for(j=start;j<len;j++)
-				data[j] = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
+				data[j] = (Qfloat)(y[i]*y[j]*k_i[j]);
 		}
 		return data;
 	}
@@ -1301,6 +1740,11 @@ public:
 		swap(QD[i],QD[j]);
 	}
 
+	void get_cache_stats(long int *hit, long int *miss) const
+	{
+		cache->get_stats(hit,miss);
+	}
+
 	~SVC_Q()
 	{
 		delete[] y;
@@ -1331,8 +1775,9 @@ public:
 		int start, j;
 		if((start = cache->get_data(i,&data,len)) < len)
 		{
+			const double *k_i = kernel_column(i,start,len);
 			for(j=start;j<len;j++)
-				data[j] = (Qfloat)(this->*kernel_function)(i,j);
+				data[j] = (Qfloat)k_i[j];
 		}
 		return data;
 	}
@@ -1349,6 +1794,11 @@ public:
 		swap(QD[i],QD[j]);
 	}
 
+	void get_cache_stats(long int *hit, long int *miss) const
+	{
+		cache->get_stats(hit,miss);
+	}
+
 	~ONE_CLASS_Q()
 	{
 		delete cache;
@@ -1397,8 +1847,9 @@ public:
 		int j, real_i = index[i];
 		if(cache->get_data(real_i,&data,l) < l)
 		{
+			const double *k_i = kernel_column(real_i,0,l);
 			for(j=0;j<l;j++)
-				data[j] = (Qfloat)(this->*kernel_function)(real_i,j);
+				data[j] = (Qfloat)k_i[j];
 		}
 
 		// reorder and copy
@@ -1415,6 +1866,11 @@ public:
 		return QD;
 	}
 
+	void get_cache_stats(long int *hit, long int *miss) const
+	{
+		cache->get_stats(hit,miss);
+	}
+
 	~SVR_Q()
 	{
 		delete cache;
@@ -1456,14 +1912,17 @@ static void solve_c_svc(
 
 	Solver s;
 	s.Solve(l, SVC_Q(*prob,*param,y), minus_ones, y,
-		alpha, Cp, Cn, param->eps, si, param->shrinking);
+		alpha, Cp, Cn, param->eps, si, param->shrinking, NULL, prob->W);
 
-	double sum_alpha=0;
+	double sum_alpha=0, sum_W=0;
 	for(i=0;i<l;i++)
+	{
 		sum_alpha += alpha[i];
+		sum_W += prob->W ? prob->W[i] : 1;
+	}
 
 	if (Cp==Cn)
-		info("nu = %f\n", sum_alpha/(Cp*prob->l));
+		info("nu = %f\n", sum_alpha/(Cp*sum_W));
 
 	for(i=0;i<l;i++)
 		alpha[i] *= y[i];
@@ -1472,6 +1931,89 @@ static void solve_c_svc(
 	delete[] y;
 }
 
+// C_SVC for a sequence of bounds (Cp[k],Cn[k]) on one Q matrix. Every solve
+// after the first starts from the previous solution moved to the new bounds,
+// with a gradient that is exact for the new start:
+//   scaled:  alpha' = s*alpha, G' = s*(G-p)+p, G_bar' = s*G_bar
+//   kept:    alpha' = alpha, G' = G, G_bar' = 0 (only if the bounds grow, then
+//            no alpha is at the new upper bound)
+// both keep y'alpha = 0; the one with the lower objective is used
+static void solve_c_svc_path(
+	const svm_problem *prob, const svm_parameter* param, int nr_C,
+	const double *Cp, const double *Cn, double **alpha_out, Solver::SolutionInfo* si)
+{
+	int l = prob->l;
+	double *minus_ones = new double[l];
+	schar *y = new schar[l];
+	double *alpha = new double[l];
+	Solver::WarmStart ws;
+	ws.G = new double[l];
+	ws.G_bar = new double[l];
+	ws.valid = false;
+
+	int i;
+
+	for(i=0;i<l;i++)
+	{
+		alpha[i] = 0;
+		minus_ones[i] = -1;
+		if(prob->y[i] > 0) y[i] = +1; else y[i] = -1;
+	}
+
+	SVC_Q Q(*prob,*param,y);
+	for(int k=0;k<nr_C;k++)
+	{
+		if(k > 0)
+		{
+			double scale = Cp[k]/Cp[k-1];
+			bool keep = false;
+			if(Cp[k] > Cp[k-1] && Cn[k] > Cn[k-1])
+			{
+				double aQa = 0, ap = 0;	// alpha'Q*alpha and p'alpha
+				for(i=0;i<l;i++)
+				{
+					aQa += alpha[i]*(ws.G[i]-minus_ones[i]);
+					ap += alpha[i]*minus_ones[i];
+				}
+				keep = aQa/2+ap <= scale*scale*aQa/2+scale*ap;
+			}
+
+			for(i=0;i<l;i++)
+			{
+				if(keep)
+				{
+					ws.G_bar[i] = 0;
+					continue;
+				}
+				double w = prob->W ? prob->W[i] : 1;
+				double C_old = w*((y[i] > 0) ? Cp[k-1] : Cn[k-1]);
+				double C_new = w*((y[i] > 0) ? Cp[k] : Cn[k]);
+				// keep bounded alphas exactly at the bound
+				if(alpha[i] >= C_old)
+					alpha[i] = C_new;
+				else
+					alpha[i] = min(alpha[i]*scale,C_new);
+				ws.G[i] = scale*(ws.G[i]-minus_ones[i])+minus_ones[i];
+				ws.G_bar[i] *= scale;
+			}
+		}
+
+		Solver s;
+		s.Solve(l, Q, minus_ones, y,
+			alpha, Cp[k], Cn[k], param->eps, &si[k], param->shrinking, &ws, prob->W);
+
+		alpha_out[k] = Malloc(double,l);
+		for(i=0;i<l;i++)
+			alpha_out[k][i] = alpha[i]*y[i];
+	}
+
+	delete[] minus_ones;
+	delete[] y;
+	delete[] alpha;
+	delete[] ws.G;
+	delete[] ws.G_bar;
+}
+
 static void solve_nu_svc(
 	const svm_problem *prob, const svm_parameter *param,
 	double *alpha, Solver::SolutionInfo* si)
@@ -1680,14 +2222,15 @@ static decision_function svm_train_one(
 		if(fabs(alpha[i]) > 0)
 		{
 			++nSV;
+			double w = prob->W ? prob->W[i] : 1;
 			if(prob->y[i] > 0)
 			{
-				if(fabs(alpha[i]) >= si.upper_bound_p)
+				if(fabs(alpha[i]) >= w*si.upper_bound_p)
 					++nBSV;
 			}
 			else
 			{
-				if(fabs(alpha[i]) >= si.upper_bound_n)
+				if(fabs(alpha[i]) >= w*si.upper_bound_n)
 					++nBSV;
 			}
 		}
@@ -1701,17 +2244,44 @@ static decision_function svm_train_one(
 	return f;
 }
 
+// decision functions for (Cp[k],Cn[k]), k = 0..nr_C-1; C_SVC solves them as a
+// warm started path, other formulations train every one from scratch
+static void svm_train_one_path(
+	const svm_problem *prob, const svm_parameter *param, int nr_C,
+	const double *Cp, const double *Cn, decision_function *f)
+{
+	if(param->svm_type != C_SVC || nr_C == 1)
+	{
+		for(int k=0;k<nr_C;k++)
+			f[k] = svm_train_one(prob,param,Cp[k],Cn[k]);
+		return;
+	}
+
+	double **alpha = Malloc(double *,nr_C);
+	Solver::SolutionInfo *si = Malloc(Solver::SolutionInfo,nr_C);
+	solve_c_svc_path(prob,param,nr_C,Cp,Cn,alpha,si);
+	for(int k=0;k<nr_C;k++)
+	{
+		info("obj = %f, rho = %f\n",si[k].obj,si[k].rho);
+		f[k].alpha = alpha[k];
+		f[k].rho = si[k].rho;
+	}
+	free(alpha);
+	free(si);
+}
+
 // Platt's binary SVM Probablistic Output: an improvement from Lin et al.
+// W[i] counts sample i that many times, NULL for once each
 static void sigmoid_train(
-	int l, const double *dec_values, const double *labels, 
+	int l, const double *dec_values, const double *labels, const double *W,
 	double& A, double& B)
 {
 	double prior1=0, prior0 = 0;
 	int i;
 
 	for (i=0;i<l;i++)
-		if (labels[i] > 0) prior1+=1;
-		else prior0+=1;
+		if (labels[i] > 0) prior1+=W ? W[i] : 1;
+		else prior0+=W ? W[i] : 1;
 	
 	int max_iter=100;	// Maximal number of iterations
 	double min_step=1e-10;	// Minimal step taken in line search
@@ -1733,10 +2303,11 @@ static void sigmoid_train(
 		if (labels[i]>0) t[i]=hiTarget;
 		else t[i]=loTarget;
 		fApB = dec_values[i]*A+B;
+		double w = W ? W[i] : 1;
 		if (fApB>=0)
-			fval += t[i]*fApB + log(1+exp(-fApB));
+			fval += w*(t[i]*fApB + log(1+exp(-fApB)));
 		else
-			fval += (t[i] - 1)*fApB +log(1+exp(fApB));
+			fval += w*((t[i] - 1)*fApB +log(1+exp(fApB)));
 	}
 	for (iter=0;iter<max_iter;iter++)
 	{
@@ -1757,11 +2328,12 @@ static void sigmoid_train(
 				p=1.0/(1.0+exp(fApB));
 				q=exp(fApB)/(1.0+exp(fApB));
 			}
-			d2=p*q;
+			double w = W ? W[i] : 1;
+			d2=w*p*q;
 			h11+=dec_values[i]*dec_values[i]*d2;
 			h22+=d2;
 			h21+=dec_values[i]*d2;
-			d1=t[i]-p;
+			d1=w*(t[i]-p);
 			g1+=dec_values[i]*d1;
 			g2+=d1;
 		}
@@ -1788,10 +2360,11 @@ static void sigmoid_train(
 			for (i=0;i<l;i++)
 			{
 				fApB = dec_values[i]*newA+newB;
+				double w = W ? W[i] : 1;
 				if (fApB >= 0)
-					newf += t[i]*fApB + log(1+exp(-fApB));
+					newf += w*(t[i]*fApB + log(1+exp(-fApB)));
 				else
-					newf += (t[i] - 1)*fApB +log(1+exp(fApB));
+					newf += w*((t[i] - 1)*fApB +log(1+exp(fApB)));
 			}
 			// Check sufficient decrease
 			if (newf<fval+0.0001*stepsize*gd)
@@ -1889,89 +2462,142 @@ static void multiclass_probability(int k, double **r, double *p)
 	free(Qp);
 }
 
-// Cross-validation decision values for probability estimates
-static void svm_binary_svc_probability(
-	const svm_problem *prob, const svm_parameter *param,
-	double Cp, double Cn, double& probA, double& probB)
+//
+// Random numbers for data shuffles (xorshift64*): every call owns its
+// generator, so shuffles are reproducible from a seed and thread safe
+//
+struct svm_rng
 {
-	int i;
-	int nr_fold = 5;
-	int *perm = Malloc(int,prob->l);
-	double *dec_values = Malloc(double,prob->l);
+	unsigned long long state;
+};
 
-	// random shuffle
+static void rng_seed(svm_rng *rng, unsigned int seed)
+{
+	// splitmix64 step, so that nearby seeds give unrelated streams
+	unsigned long long z = (unsigned long long)seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	rng->state = (z ^ (z >> 31)) | 1;
+}
+
+// uniform in [0,n)
+static int rng_next(svm_rng *rng, int n)
+{
+	rng->state ^= rng->state >> 12;
+	rng->state ^= rng->state << 25;
+	rng->state ^= rng->state >> 27;
+	return (int)(((rng->state * 0x2545F4914F6CDD1DULL) >> 33) % (unsigned long long)n);
+}
+
+static int get_nr_prob_fold(const svm_parameter *param)
+{
+	int nr_fold = param->nr_prob_fold;
+	if(nr_fold <= 0)
+	{
+		const char *env = getenv("SVM_PROB_FOLDS");
+		nr_fold = env ? atoi(env) : 0;
+	}
+	return nr_fold >= 2 ? nr_fold : 5;
+}
+
+// Cross-validation decision values for probability estimates
+static void svm_binary_svc_probability(
+	const svm_problem *prob, const svm_parameter *param,
+	double Cp, double Cn, unsigned int seed, double& probA, double& probB)
+{
+	int i;
+	int nr_fold = get_nr_prob_fold(param);
+	int *perm = Malloc(int,prob->l);
+	double *dec_values = Malloc(double,prob->l);
+	svm_rng rng;
+	rng_seed(&rng,seed);
+
+	// random shuffle
 	for(i=0;i<prob->l;i++) perm[i]=i;
 	for(i=0;i<prob->l;i++)
 	{
-		int j = i+rand()%(prob->l-i);
+		int j = i+rng_next(&rng,prob->l-i);
 		swap(perm[i],perm[j]);
 	}
-	for(i=0;i<nr_fold;i++)
-	{
-		int begin = i*prob->l/nr_fold;
-		int end = (i+1)*prob->l/nr_fold;
-		int j,k;
-		struct svm_problem subprob;
 
-		subprob.l = prob->l-(end-begin);
-		subprob.x = Malloc(struct svm_node*,subprob.l);
-		subprob.y = Malloc(double,subprob.l);
-			
-		k=0;
-		for(j=0;j<begin;j++)
-		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
-		}
-		for(j=end;j<prob->l;j++)
+	// every fold writes its own part of dec_values, train them concurrently
+	// with an equal share of cache_size and of the threads each
+	int nr_thread = svm_resolve_nr_thread(param->nr_thread);
+	int nr_concurrent = max(min(nr_fold,nr_thread),1);
+	parallel_for(0,nr_fold,1,nr_thread,[&](int fold_begin, int fold_end) {
+		for(int i=fold_begin;i<fold_end;i++)
 		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
-		}
-		int p_count=0,n_count=0;
-		for(j=0;j<k;j++)
-			if(subprob.y[j]>0)
-				p_count++;
+			int begin = i*prob->l/nr_fold;
+			int end = (i+1)*prob->l/nr_fold;
+			int j,k;
+			struct svm_problem subprob;
+
+			subprob.l = prob->l-(end-begin);
+			subprob.x = Malloc(struct svm_node*,subprob.l);
+			subprob.y = Malloc(double,subprob.l);
+			subprob.W = prob->W ? Malloc(double,subprob.l) : NULL;
+			
+			k=0;
+			for(j=0;j<begin;j++)
+			{
+				subprob.x[k] = prob->x[perm[j]];
+				subprob.y[k] = prob->y[perm[j]];
+				if(subprob.W) subprob.W[k] = prob->W[perm[j]];
+				++k;
+			}
+			for(j=end;j<prob->l;j++)
+			{
+				subprob.x[k] = prob->x[perm[j]];
+				subprob.y[k] = prob->y[perm[j]];
+				if(subprob.W) subprob.W[k] = prob->W[perm[j]];
+				++k;
+			}
+			int p_count=0,n_count=0;
+			for(j=0;j<k;j++)
+				if(subprob.y[j]>0)
+					p_count++;
+				else
+					n_count++;
+
+			if(p_count==0 && n_count==0)
+				for(j=begin;j<end;j++)
+					dec_values[perm[j]] = 0;
+			else if(p_count > 0 && n_count == 0)
+				for(j=begin;j<end;j++)
+					dec_values[perm[j]] = 1;
+			else if(p_count == 0 && n_count > 0)
+				for(j=begin;j<end;j++)
+					dec_values[perm[j]] = -1;
 			else
-				n_count++;
-
-		if(p_count==0 && n_count==0)
-			for(j=begin;j<end;j++)
-				dec_values[perm[j]] = 0;
-		else if(p_count > 0 && n_count == 0)
-			for(j=begin;j<end;j++)
-				dec_values[perm[j]] = 1;
-		else if(p_count == 0 && n_count > 0)
-			for(j=begin;j<end;j++)
-				dec_values[perm[j]] = -1;
-		else
-		{
-			svm_parameter subparam = *param;
-			subparam.probability=0;
-			subparam.C=1.0;
-			subparam.nr_weight=2;
-			subparam.weight_label = Malloc(int,2);
-			subparam.weight = Malloc(double,2);
-			subparam.weight_label[0]=+1;
-			subparam.weight_label[1]=-1;
-			subparam.weight[0]=Cp;
-			subparam.weight[1]=Cn;
-			struct svm_model *submodel = svm_train(&subprob,&subparam);
-			for(j=begin;j<end;j++)
 			{
-				svm_predict_values(submodel,prob->x[perm[j]],&(dec_values[perm[j]]));
-				// ensure +1 -1 order; reason not using CV subroutine
-				dec_values[perm[j]] *= submodel->label[0];
-			}		
-			svm_free_and_destroy_model(&submodel);
-			svm_destroy_param(&subparam);
+				svm_parameter subparam = *param;
+				subparam.probability=0;
+				subparam.C=1.0;
+				subparam.cache_size=param->cache_size/nr_concurrent;
+				subparam.nr_thread=max(nr_thread/nr_concurrent,1);
+				subparam.nr_weight=2;
+				subparam.weight_label = Malloc(int,2);
+				subparam.weight = Malloc(double,2);
+				subparam.weight_label[0]=+1;
+				subparam.weight_label[1]=-1;
+				subparam.weight[0]=Cp;
+				subparam.weight[1]=Cn;
+				struct svm_model *submodel = svm_train(&subprob,&subparam);
+				for(j=begin;j<end;j++)
+				{
+					svm_predict_values(submodel,prob->x[perm[j]],&(dec_values[perm[j]]));
+					// ensure +1 -1 order; reason not using CV subroutine
+					dec_values[perm[j]] *= submodel->label[0];
+				}		
+				svm_free_and_destroy_model(&submodel);
+				svm_destroy_param(&subparam);
+			}
+			free(subprob.x);
+			free(subprob.y);
+			free(subprob.W);
 		}
-		free(subprob.x);
-		free(subprob.y);
-	}		
-	sigmoid_train(prob->l,dec_values,prob->y,probA,probB);
+	});
+	sigmoid_train(prob->l,dec_values,prob->y,prob->W,probA,probB);
 	free(dec_values);
 	free(perm);
 }
@@ -1981,13 +2607,13 @@ static double svm_svr_probability(
 	const svm_problem *prob, const svm_parameter *param)
 {
 	int i;
-	int nr_fold = 5;
+	int nr_fold = get_nr_prob_fold(param);
 	double *ymv = Malloc(double,prob->l);
 	double mae = 0;
 
 	svm_parameter newparam = *param;
 	newparam.probability = 0;
-	svm_cross_validation(prob,&newparam,nr_fold,ymv);
+	svm_cross_validation_seed(prob,&newparam,nr_fold,param->seed,ymv);
 	for(i=0;i<prob->l;i++)
 	{
 		ymv[i]=prob->y[i]-ymv[i];
@@ -2087,82 +2713,202 @@ static void svm_group_classes(const svm_problem *prob, int *nr_class_ret, int **
 }
 
 //
-// Interface functions
+// Dense SVs for prediction
 //
-svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
-{
-	svm_model *model = Malloc(svm_model,1);
-	model->param = *param;
-	model->free_sv = 0;	// XXX
+#define DENSE_PREDICT_MAX_DIM 64
 
-	if(param->svm_type == ONE_CLASS ||
-	   param->svm_type == EPSILON_SVR ||
-	   param->svm_type == NU_SVR)
+static void build_dense_sv(svm_model *model)
+{
+	model->dense_dim = 0;
+	model->dense_base = 0;
+	model->SV_dense = NULL;
+	model->SV_dense_f = NULL;
+	model->SV_dense_t = NULL;
+	model->sv_square = NULL;
+	if(model->param.kernel_type == PRECOMPUTED)
+		return;
+
+	int base = 0;
+	int dim = get_dense_dim(model->SV,model->l,&base);
+	if(dim <= 0 || dim > DENSE_PREDICT_MAX_DIM)
+		return;
+
+	if(model->param.float_storage)
 	{
-		// regression or one-class-svm
-		model->nr_class = 2;
-		model->label = NULL;
-		model->nSV = NULL;
-		model->probA = NULL; model->probB = NULL;
-		model->sv_coef = Malloc(double *,1);
+		model->SV_dense_f = Malloc(float,(size_t)model->l*dim);
+		for(int i=0;i<model->l;i++)
+			for(int k=0;k<dim;k++)
+				model->SV_dense_f[(size_t)i*dim+k] = (float)model->SV[i][k].value;
+	}
+	else
+	{
+		model->SV_dense = Malloc(double,(size_t)model->l*dim);
+		for(int i=0;i<model->l;i++)
+			for(int k=0;k<dim;k++)
+				model->SV_dense[(size_t)i*dim+k] = model->SV[i][k].value;
+	}
+	model->dense_dim = dim;
+	model->dense_base = base;
 
-		if(param->probability && 
-		   (param->svm_type == EPSILON_SVR ||
-		    param->svm_type == NU_SVR))
+	// RBF as exp(-gamma*(|x|^2+|sv|^2-2x.sv)): the dot products of a sample with
+	// all SVs are contiguous axpys over the columns of SV_dense_t
+	if(model->param.kernel_type == RBF && model->SV_dense)
+	{
+		int l = model->l;
+		model->SV_dense_t = Malloc(double,(size_t)dim*l);
+		model->sv_square = Malloc(double,l);
+		for(int i=0;i<l;i++)
 		{
-			model->probA = Malloc(double,1);
-			model->probA[0] = svm_svr_probability(prob,param);
+			const double *sv = &model->SV_dense[(size_t)i*dim];
+			for(int k=0;k<dim;k++)
+				model->SV_dense_t[(size_t)k*l+i] = sv[k];
+			model->sv_square[i] = dot_dense(sv,sv,dim);
 		}
+	}
+}
 
-		decision_function f = svm_train_one(prob,param,0,0);
-		model->rho = Malloc(double,1);
-		model->rho[0] = f.rho;
+// copy x to xd if both x and the SVs of model are dense with the same layout;
+// with float SVs x is rounded to float too, as the training rows were
+static bool get_dense_row(const svm_model *model, const svm_node *x, double *xd)
+{
+	int dim = model->dense_dim;
+	if(dim == 0 || !is_dense_row(x,dim,model->dense_base))
+		return false;
+	if(model->SV_dense_f)
+		for(int k=0;k<dim;k++)
+			xd[k] = (float)x[k].value;
+	else
+		for(int k=0;k<dim;k++)
+			xd[k] = x[k].value;
+	return true;
+}
 
-		int nSV = 0;
-		int i;
-		for(i=0;i<prob->l;i++)
-			if(fabs(f.alpha[i]) > 0) ++nSV;
-		model->l = nSV;
-		model->SV = Malloc(svm_node *,nSV);
-		model->sv_coef[0] = Malloc(double,nSV);
-		model->sv_indices = Malloc(int,nSV);
-		int j = 0;
-		for(i=0;i<prob->l;i++)
-			if(fabs(f.alpha[i]) > 0)
-			{
-				model->SV[j] = prob->x[i];
-				model->sv_coef[0][j] = f.alpha[i];
-				model->sv_indices[j] = i+1;
-				++j;
-			}		
+static inline double sv_k_function(const svm_model *model, int i, const svm_node *x, const double *xd)
+{
+	if(xd && model->SV_dense_f)
+		return Kernel::k_function_dense(xd,&model->SV_dense_f[(size_t)i*model->dense_dim],model->dense_dim,model->param);
+	else if(xd)
+		return Kernel::k_function_dense(xd,&model->SV_dense[(size_t)i*model->dense_dim],model->dense_dim,model->param);
+	else
+		return Kernel::k_function(x,model->SV[i],model->param);
+}
 
-		free(f.alpha);
+// K(x,SV[i]) for every SV, xd is the dense copy of x or NULL
+static void sv_k_values(const svm_model *model, const svm_node *x, const double *xd, double *kvalue)
+{
+	int l = model->l;
+	if(xd && model->sv_square)
+	{
+		int dim = model->dense_dim;
+		rbf_cols_function rbf_cols = get_rbf_cols_function();
+		rbf_cols(xd,model->SV_dense_t,l,dim,dot_dense(xd,xd,dim),model->sv_square,model->param.gamma,l,kvalue);
 	}
 	else
+		for(int i=0;i<l;i++)
+			kvalue[i] = sv_k_function(model,i,x,xd);
+}
+
+//
+// Kernel matrix construction, through Kernel so that the values are the
+// ones a training would compute itself
+//
+class KM_Builder: public Kernel
+{
+public:
+	KM_Builder(const svm_problem& prob, const svm_parameter& param)
+	:Kernel(prob.l, prob.x, param)
 	{
-		// classification
-		int l = prob->l;
-		int nr_class;
-		int *label = NULL;
-		int *start = NULL;
-		int *count = NULL;
-		int *perm = Malloc(int,l);
+	}
+	Qfloat *get_Q(int, int) const { return 0; }	// never used as a QMatrix
+	double *get_QD() const { return 0; }
+	void fill(int i, int l, double *out) const
+	{
+		fill_kernel_column(i,0,l,out);
+	}
+};
 
-		// group training data of the same class
-		svm_group_classes(prob,&nr_class,&label,&start,&count,perm);
-		if(nr_class == 1) 
-			info("WARNING: training data in only one class. See README for details.\n");
-		
-		svm_node **x = Malloc(svm_node *,l);
-		int i;
-		for(i=0;i<l;i++)
-			x[i] = prob->x[perm[i]];
+svm_kernel_matrix *svm_kernel_matrix_create(const svm_problem *prob, const svm_parameter *param)
+{
+	int l = prob->l;
+	svm_kernel_matrix *km = Malloc(svm_kernel_matrix,1);
+	km->l = l;
+	km->kernel_type = param->kernel_type;
+	km->degree = param->degree;
+	km->gamma = param->gamma;
+	km->coef0 = param->coef0;
+	km->float_storage = param->float_storage;
+	km->data = Malloc(Qfloat,(size_t)l*l);
+	km->rows = Malloc(svm_kernel_matrix::row,l);
+	for(int i=0;i<l;i++)
+	{
+		km->rows[i].x = prob->x[i];
+		km->rows[i].index = i;
+	}
+	qsort(km->rows,l,sizeof(svm_kernel_matrix::row),compare_km_row);
+
+	// rows are filled in parallel, each one by a single thread
+	int nr_thread = svm_resolve_nr_thread(param->nr_thread);
+	svm_parameter build_param = *param;
+	build_param.kernel_matrix = NULL;
+	build_param.nr_thread = 1;
+	KM_Builder builder(*prob,build_param);
+	parallel_for(0,l,max(KERNEL_COLUMN_GRAIN/max(l,1),1),nr_thread,[&](int begin, int end) {
+		double *column = Malloc(double,l);
+		for(int i=begin;i<end;i++)
+		{
+			builder.fill(i,l,column);
+			Qfloat *K_i = &km->data[(size_t)i*l];
+			for(int j=0;j<l;j++)
+				K_i[j] = (Qfloat)column[j];
+		}
+		free(column);
+	});
+	return km;
+}
+
+void svm_kernel_matrix_free(svm_kernel_matrix *km)
+{
+	if(km == NULL)
+		return;
+	free(km->data);
+	free(km->rows);
+	free(km);
+}
 
-		// calculate weighted C
+double svm_kernel_matrix_size(int l)
+{
+	return (double)l*l*sizeof(Qfloat)/(1<<20);
+}
 
-		double *weighted_C = Malloc(double, nr_class);
+// classification models for C[m], m = 0..nr_C-1, into models[m] whose param is set
+static void svm_train_classifier(const svm_problem *prob, const svm_parameter *param,
+				 int nr_C, const double *C, svm_model **models)
+{
+	int l = prob->l;
+	int nr_class;
+	int *label = NULL;
+	int *start = NULL;
+	int *count = NULL;
+	int *perm = Malloc(int,l);
+
+	// group training data of the same class
+	svm_group_classes(prob,&nr_class,&label,&start,&count,perm);
+	if(nr_class == 1) 
+		info("WARNING: training data in only one class. See README for details.\n");
+	
+	svm_node **x = Malloc(svm_node *,l);
+	int i,m;
+	for(i=0;i<l;i++)
+		x[i] = prob->x[perm[i]];
+
+	// calculate weighted C, weighted_C[m*nr_class+i] for C[m]
+
+	double *weighted_C = Malloc(double, nr_C*nr_class);
+	for(m=0;m<nr_C;m++)
+	{
+		double *weighted_C_m = &weighted_C[m*nr_class];
 		for(i=0;i<nr_class;i++)
-			weighted_C[i] = param->C;
+			weighted_C_m[i] = C[m];
 		for(i=0;i<param->nr_weight;i++)
 		{	
 			int j;
@@ -2170,61 +2916,128 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 				if(param->weight_label[i] == label[j])
 					break;
 			if(j == nr_class)
-				fprintf(stderr,"WARNING: class label %d specified in weight is not found\n", param->weight_label[i]);
+			{
+				if(m == 0)
+					fprintf(stderr,"WARNING: class label %d specified in weight is not found\n", param->weight_label[i]);
+			}
 			else
-				weighted_C[j] *= param->weight[i];
+				weighted_C_m[j] *= param->weight[i];
 		}
+	}
 
-		// train k*(k-1)/2 models
-		
-		bool *nonzero = Malloc(bool,l);
-		for(i=0;i<l;i++)
-			nonzero[i] = false;
-		decision_function *f = Malloc(decision_function,nr_class*(nr_class-1)/2);
+	// train k*(k-1)/2 models for every C, f[m*nr_pair+p] for C[m] and pair p
+	
+	int nr_pair = nr_class*(nr_class-1)/2;
+	bool *nonzero = Malloc(bool,l);
+	decision_function *f = Malloc(decision_function,nr_C*nr_pair);
+
+	double *probA=NULL,*probB=NULL;
+	if (param->probability)
+	{
+		probA=Malloc(double,nr_C*nr_pair);
+		probB=Malloc(double,nr_C*nr_pair);
+	}
 
-		double *probA=NULL,*probB=NULL;
-		if (param->probability)
+	svm_problem *sub_prob = Malloc(svm_problem,nr_pair);
+	int *pair_i = Malloc(int,nr_pair);
+	int *pair_j = Malloc(int,nr_pair);
+	int p = 0;
+	for(i=0;i<nr_class;i++)
+		for(int j=i+1;j<nr_class;j++)
 		{
-			probA=Malloc(double,nr_class*(nr_class-1)/2);
-			probB=Malloc(double,nr_class*(nr_class-1)/2);
+			int si = start[i], sj = start[j];
+			int ci = count[i], cj = count[j];
+			sub_prob[p].l = ci+cj;
+			sub_prob[p].x = Malloc(svm_node *,sub_prob[p].l);
+			sub_prob[p].y = Malloc(double,sub_prob[p].l);
+			sub_prob[p].W = prob->W ? Malloc(double,sub_prob[p].l) : NULL;
+			int k;
+			for(k=0;k<ci;k++)
+			{
+				sub_prob[p].x[k] = x[si+k];
+				sub_prob[p].y[k] = +1;
+				if(prob->W) sub_prob[p].W[k] = prob->W[perm[si+k]];
+			}
+			for(k=0;k<cj;k++)
+			{
+				sub_prob[p].x[ci+k] = x[sj+k];
+				sub_prob[p].y[ci+k] = -1;
+				if(prob->W) sub_prob[p].W[ci+k] = prob->W[perm[sj+k]];
+			}
+			pair_i[p] = i;
+			pair_j[p] = j;
+			++p;
 		}
 
-		int p = 0;
-		for(i=0;i<nr_class;i++)
-			for(int j=i+1;j<nr_class;j++)
-			{
-				svm_problem sub_prob;
-				int si = start[i], sj = start[j];
-				int ci = count[i], cj = count[j];
-				sub_prob.l = ci+cj;
-				sub_prob.x = Malloc(svm_node *,sub_prob.l);
-				sub_prob.y = Malloc(double,sub_prob.l);
-				int k;
-				for(k=0;k<ci;k++)
-				{
-					sub_prob.x[k] = x[si+k];
-					sub_prob.y[k] = +1;
-				}
-				for(k=0;k<cj;k++)
-				{
-					sub_prob.x[ci+k] = x[sj+k];
-					sub_prob.y[ci+k] = -1;
-				}
+	// the pairs are independent: train them concurrently, every running pair
+	// gets an equal share of cache_size and of the threads, and shuffles its
+	// probability folds with a seed of its own. Pairs are claimed one at a time,
+	// largest first, so a big pair never waits behind a batch of small ones
+	int nr_thread = svm_resolve_nr_thread(param->nr_thread);
+	int nr_concurrent = max(min(nr_pair,nr_thread),1);
+	svm_parameter pair_param = *param;
+	pair_param.cache_size = param->cache_size/nr_concurrent;
+	pair_param.nr_thread = max(nr_thread/nr_concurrent,1);
+	int *pair_order = Malloc(int,nr_pair);
+	for(p=0;p<nr_pair;p++)
+	{
+		int r = p;
+		for(;r>0 && sub_prob[pair_order[r-1]].l < sub_prob[p].l;r--)
+			pair_order[r] = pair_order[r-1];
+		pair_order[r] = p;
+	}
+	parallel_for_each(nr_pair,nr_thread,[&](int k) {
+		int q = pair_order[k];
+		double *Cp = Malloc(double,nr_C);
+		double *Cn = Malloc(double,nr_C);
+		decision_function *f_q = Malloc(decision_function,nr_C);
+		for(int m=0;m<nr_C;m++)
+		{
+			Cp[m] = weighted_C[m*nr_class+pair_i[q]];
+			Cn[m] = weighted_C[m*nr_class+pair_j[q]];
+		}
+		if(param->probability)
+			for(int m=0;m<nr_C;m++)
+				svm_binary_svc_probability(&sub_prob[q],&pair_param,Cp[m],Cn[m],
+							   param->seed+(unsigned int)q,probA[m*nr_pair+q],probB[m*nr_pair+q]);
+		svm_train_one_path(&sub_prob[q],&pair_param,nr_C,Cp,Cn,f_q);
+		for(int m=0;m<nr_C;m++)
+			f[m*nr_pair+q] = f_q[m];
+		free(Cp);
+		free(Cn);
+		free(f_q);
+	});
+	free(pair_order);
+
+	for(p=0;p<nr_pair;p++)
+	{
+		free(sub_prob[p].x);
+		free(sub_prob[p].y);
+		free(sub_prob[p].W);
+	}
+	free(sub_prob);
 
-				if(param->probability)
-					svm_binary_svc_probability(&sub_prob,param,weighted_C[i],weighted_C[j],probA[p],probB[p]);
+	int *nz_count = Malloc(int,nr_class);
+	int *nz_start = Malloc(int,nr_class);
+	for(m=0;m<nr_C;m++)
+	{
+		svm_model *model = models[m];
+		decision_function *f_m = &f[m*nr_pair];
 
-				f[p] = svm_train_one(&sub_prob,param,weighted_C[i],weighted_C[j]);
-				for(k=0;k<ci;k++)
-					if(!nonzero[si+k] && fabs(f[p].alpha[k]) > 0)
-						nonzero[si+k] = true;
-				for(k=0;k<cj;k++)
-					if(!nonzero[sj+k] && fabs(f[p].alpha[ci+k]) > 0)
-						nonzero[sj+k] = true;
-				free(sub_prob.x);
-				free(sub_prob.y);
-				++p;
-			}
+		for(i=0;i<l;i++)
+			nonzero[i] = false;
+		for(p=0;p<nr_pair;p++)
+		{
+			int si = start[pair_i[p]], sj = start[pair_j[p]];
+			int ci = count[pair_i[p]], cj = count[pair_j[p]];
+			int k;
+			for(k=0;k<ci;k++)
+				if(!nonzero[si+k] && fabs(f_m[p].alpha[k]) > 0)
+					nonzero[si+k] = true;
+			for(k=0;k<cj;k++)
+				if(!nonzero[sj+k] && fabs(f_m[p].alpha[ci+k]) > 0)
+					nonzero[sj+k] = true;
+		}
 
 		// build output
 
@@ -2234,18 +3047,18 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 		for(i=0;i<nr_class;i++)
 			model->label[i] = label[i];
 		
-		model->rho = Malloc(double,nr_class*(nr_class-1)/2);
-		for(i=0;i<nr_class*(nr_class-1)/2;i++)
-			model->rho[i] = f[i].rho;
+		model->rho = Malloc(double,nr_pair);
+		for(i=0;i<nr_pair;i++)
+			model->rho[i] = f_m[i].rho;
 
 		if(param->probability)
 		{
-			model->probA = Malloc(double,nr_class*(nr_class-1)/2);
-			model->probB = Malloc(double,nr_class*(nr_class-1)/2);
-			for(i=0;i<nr_class*(nr_class-1)/2;i++)
+			model->probA = Malloc(double,nr_pair);
+			model->probB = Malloc(double,nr_pair);
+			for(i=0;i<nr_pair;i++)
 			{
-				model->probA[i] = probA[i];
-				model->probB[i] = probB[i];
+				model->probA[i] = probA[m*nr_pair+i];
+				model->probB[i] = probB[m*nr_pair+i];
 			}
 		}
 		else
@@ -2255,7 +3068,6 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 		}
 
 		int total_sv = 0;
-		int *nz_count = Malloc(int,nr_class);
 		model->nSV = Malloc(int,nr_class);
 		for(i=0;i<nr_class;i++)
 		{
@@ -2283,7 +3095,6 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 				model->sv_indices[p++] = perm[i] + 1;
 			}
 
-		int *nz_start = Malloc(int,nr_class);
 		nz_start[0] = 0;
 		for(i=1;i<nr_class;i++)
 			nz_start[i] = nz_start[i-1]+nz_count[i-1];
@@ -2309,40 +3120,135 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 				int k;
 				for(k=0;k<ci;k++)
 					if(nonzero[si+k])
-						model->sv_coef[j-1][q++] = f[p].alpha[k];
+						model->sv_coef[j-1][q++] = f_m[p].alpha[k];
 				q = nz_start[j];
 				for(k=0;k<cj;k++)
 					if(nonzero[sj+k])
-						model->sv_coef[i][q++] = f[p].alpha[ci+k];
+						model->sv_coef[i][q++] = f_m[p].alpha[ci+k];
 				++p;
 			}
-		
-		free(label);
-		free(probA);
-		free(probB);
-		free(count);
-		free(perm);
-		free(start);
-		free(x);
-		free(weighted_C);
-		free(nonzero);
-		for(i=0;i<nr_class*(nr_class-1)/2;i++)
-			free(f[i].alpha);
-		free(f);
-		free(nz_count);
-		free(nz_start);
 	}
+	
+	free(label);
+	free(probA);
+	free(probB);
+	free(count);
+	free(perm);
+	free(start);
+	free(x);
+	free(weighted_C);
+	free(nonzero);
+	free(pair_i);
+	free(pair_j);
+	for(i=0;i<nr_C*nr_pair;i++)
+		free(f[i].alpha);
+	free(f);
+	free(nz_count);
+	free(nz_start);
+}
+
+//
+// Interface functions
+//
+svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
+{
+	svm_model *model = Malloc(svm_model,1);
+	model->param = *param;
+	model->param.kernel_matrix = NULL;
+	model->free_sv = 0;	// XXX
+
+	if(param->svm_type == ONE_CLASS ||
+	   param->svm_type == EPSILON_SVR ||
+	   param->svm_type == NU_SVR)
+	{
+		// regression or one-class-svm
+		model->nr_class = 2;
+		model->label = NULL;
+		model->nSV = NULL;
+		model->probA = NULL; model->probB = NULL;
+		model->sv_coef = Malloc(double *,1);
+
+		if(param->probability && 
+		   (param->svm_type == EPSILON_SVR ||
+		    param->svm_type == NU_SVR))
+		{
+			model->probA = Malloc(double,1);
+			model->probA[0] = svm_svr_probability(prob,param);
+		}
+
+		decision_function f = svm_train_one(prob,param,0,0);
+		model->rho = Malloc(double,1);
+		model->rho[0] = f.rho;
+
+		int nSV = 0;
+		int i;
+		for(i=0;i<prob->l;i++)
+			if(fabs(f.alpha[i]) > 0) ++nSV;
+		model->l = nSV;
+		model->SV = Malloc(svm_node *,nSV);
+		model->sv_coef[0] = Malloc(double,nSV);
+		model->sv_indices = Malloc(int,nSV);
+		int j = 0;
+		for(i=0;i<prob->l;i++)
+			if(fabs(f.alpha[i]) > 0)
+			{
+				model->SV[j] = prob->x[i];
+				model->sv_coef[0][j] = f.alpha[i];
+				model->sv_indices[j] = i+1;
+				++j;
+			}		
+
+		free(f.alpha);
+	}
+	else
+		svm_train_classifier(prob,param,1,&param->C,&model);
+	build_dense_sv(model);
 	return model;
 }
 
+void svm_train_path(const svm_problem *prob, const svm_parameter *param,
+		    int nr_C, const double *C, svm_model **models)
+{
+	int m;
+	if(param->svm_type != C_SVC)
+	{
+		for(m=0;m<nr_C;m++)
+		{
+			svm_parameter param_m = *param;
+			param_m.C = C[m];
+			models[m] = svm_train(prob,&param_m);
+		}
+		return;
+	}
+
+	for(m=0;m<nr_C;m++)
+	{
+		models[m] = Malloc(svm_model,1);
+		models[m]->param = *param;
+		models[m]->param.C = C[m];
+		models[m]->param.kernel_matrix = NULL;
+		models[m]->free_sv = 0;
+	}
+	svm_train_classifier(prob,param,nr_C,C,models);
+	for(m=0;m<nr_C;m++)
+		build_dense_sv(models[m]);
+}
+
 // Stratified cross validation
 void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, int nr_fold, double *target)
+{
+	svm_cross_validation_seed(prob,param,nr_fold,(unsigned int)rand(),target);
+}
+
+void svm_cross_validation_seed(const svm_problem *prob, const svm_parameter *param, int nr_fold, unsigned int seed, double *target)
 {
 	int i;
 	int *fold_start;
 	int l = prob->l;
 	int *perm = Malloc(int,l);
 	int nr_class;
+	svm_rng rng;
+	rng_seed(&rng,seed);
 	if (nr_fold > l)
 	{
 		nr_fold = l;
@@ -2368,7 +3274,7 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 		for (c=0; c<nr_class; c++) 
 			for(i=0;i<count[c];i++)
 			{
-				int j = i+rand()%(count[c]-i);
+				int j = i+rng_next(&rng,count[c]-i);
 				swap(index[start[c]+j],index[start[c]+i]);
 			}
 		for(i=0;i<nr_fold;i++)
@@ -2405,53 +3311,66 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 		for(i=0;i<l;i++) perm[i]=i;
 		for(i=0;i<l;i++)
 		{
-			int j = i+rand()%(l-i);
+			int j = i+rng_next(&rng,l-i);
 			swap(perm[i],perm[j]);
 		}
 		for(i=0;i<=nr_fold;i++)
 			fold_start[i]=i*l/nr_fold;
 	}
 
-	for(i=0;i<nr_fold;i++)
-	{
-		int begin = fold_start[i];
-		int end = fold_start[i+1];
-		int j,k;
-		struct svm_problem subprob;
-
-		subprob.l = l-(end-begin);
-		subprob.x = Malloc(struct svm_node*,subprob.l);
-		subprob.y = Malloc(double,subprob.l);
-			
-		k=0;
-		for(j=0;j<begin;j++)
+	// folds are independent, train them concurrently with an equal share of
+	// cache_size and of the threads each
+	int nr_thread = svm_resolve_nr_thread(param->nr_thread);
+	int nr_concurrent = max(min(nr_fold,nr_thread),1);
+	svm_parameter fold_param = *param;
+	fold_param.cache_size = param->cache_size/nr_concurrent;
+	fold_param.nr_thread = max(nr_thread/nr_concurrent,1);
+	parallel_for(0,nr_fold,1,nr_thread,[&](int fold_begin, int fold_end) {
+		for(int i=fold_begin;i<fold_end;i++)
 		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
-		}
-		for(j=end;j<l;j++)
-		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
-		}
-		struct svm_model *submodel = svm_train(&subprob,param);
-		if(param->probability && 
-		   (param->svm_type == C_SVC || param->svm_type == NU_SVC))
-		{
-			double *prob_estimates=Malloc(double,svm_get_nr_class(submodel));
-			for(j=begin;j<end;j++)
-				target[perm[j]] = svm_predict_probability(submodel,prob->x[perm[j]],prob_estimates);
-			free(prob_estimates);
+			int begin = fold_start[i];
+			int end = fold_start[i+1];
+			int j,k;
+			struct svm_problem subprob;
+
+			subprob.l = l-(end-begin);
+			subprob.x = Malloc(struct svm_node*,subprob.l);
+			subprob.y = Malloc(double,subprob.l);
+			subprob.W = prob->W ? Malloc(double,subprob.l) : NULL;
+			
+			k=0;
+			for(j=0;j<begin;j++)
+			{
+				subprob.x[k] = prob->x[perm[j]];
+				subprob.y[k] = prob->y[perm[j]];
+				if(subprob.W) subprob.W[k] = prob->W[perm[j]];
+				++k;
+			}
+			for(j=end;j<l;j++)
+			{
+				subprob.x[k] = prob->x[perm[j]];
+				subprob.y[k] = prob->y[perm[j]];
+				if(subprob.W) subprob.W[k] = prob->W[perm[j]];
+				++k;
+			}
+			struct svm_model *submodel = svm_train(&subprob,&fold_param);
+			if(param->probability && 
+			   (param->svm_type == C_SVC || param->svm_type == NU_SVC))
+			{
+				double *prob_estimates=Malloc(double,svm_get_nr_class(submodel));
+				for(j=begin;j<end;j++)
+					target[perm[j]] = svm_predict_probability(submodel,prob->x[perm[j]],prob_estimates);
+				free(prob_estimates);
+			}
+			else
+				for(j=begin;j<end;j++)
+					target[perm[j]] = svm_predict(submodel,prob->x[perm[j]]);
+			svm_free_and_destroy_model(&submodel);
+			free(subprob.x);
+			free(subprob.y);
+			free(subprob.W);
 		}
-		else
-			for(j=begin;j<end;j++)
-				target[perm[j]] = svm_predict(submodel,prob->x[perm[j]]);
-		svm_free_and_destroy_model(&submodel);
-		free(subprob.x);
-		free(subprob.y);
-	}		
+	});
 	free(fold_start);
 	free(perm);
 }
@@ -2498,7 +3417,19 @@ double svm_get_svr_probability(const svm_model *model)
 	}
 }
 
-double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+// start[i] = index of the first SV of class i
+static void fill_class_start(const svm_model *model, int *start)
+{
+	if(model->nSV == NULL)
+		return;
+	start[0] = 0;
+	for(int i=1;i<model->nr_class;i++)
+		start[i] = start[i-1]+model->nSV[i-1];
+}
+
+// decision values and prediction from kvalue[i] = K(x,SV[i]);
+// start comes from fill_class_start, vote is scratch of nr_class ints
+static double predict_from_kvalue(const svm_model *model, const double *kvalue, const int *start, int *vote, double* dec_values)
 {
 	int i;
 	if(model->param.svm_type == ONE_CLASS ||
@@ -2508,7 +3439,7 @@ double svm_predict_values(const svm_model *model, const svm_node *x, double* dec
 		double *sv_coef = model->sv_coef[0];
 		double sum = 0;
 		for(i=0;i<model->l;i++)
-			sum += sv_coef[i] * Kernel::k_function(x,model->SV[i],model->param);
+			sum += sv_coef[i] * kvalue[i];
 		sum -= model->rho[0];
 		*dec_values = sum;
 
@@ -2520,18 +3451,6 @@ double svm_predict_values(const svm_model *model, const svm_node *x, double* dec
 	else
 	{
 		int nr_class = model->nr_class;
-		int l = model->l;
-		
-		double *kvalue = Malloc(double,l);
-		for(i=0;i<l;i++)
-			kvalue[i] = Kernel::k_function(x,model->SV[i],model->param);
-
-		int *start = Malloc(int,nr_class);
-		start[0] = 0;
-		for(i=1;i<nr_class;i++)
-			start[i] = start[i-1]+model->nSV[i-1];
-
-		int *vote = Malloc(int,nr_class);
 		for(i=0;i<nr_class;i++)
 			vote[i] = 0;
 
@@ -2567,13 +3486,31 @@ double svm_predict_values(const svm_model *model, const svm_node *x, double* dec
 			if(vote[i] > vote[vote_max_idx])
 				vote_max_idx = i;
 
-		free(kvalue);
-		free(start);
-		free(vote);
 		return model->label[vote_max_idx];
 	}
 }
 
+double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+{
+	double xd_space[DENSE_PREDICT_MAX_DIM];
+	const double *xd = get_dense_row(model,x,xd_space) ? xd_space : NULL;
+
+	int l = model->l;
+	int nr_class = model->nr_class;
+	double *kvalue = Malloc(double,l);
+	sv_k_values(model,x,xd,kvalue);
+
+	int *start = Malloc(int,nr_class);
+	int *vote = Malloc(int,nr_class);
+	fill_class_start(model,start);
+	double pred_result = predict_from_kvalue(model,kvalue,start,vote,dec_values);
+
+	free(kvalue);
+	free(start);
+	free(vote);
+	return pred_result;
+}
+
 double svm_predict(const svm_model *model, const svm_node *x)
 {
 	int nr_class = model->nr_class;
@@ -2589,6 +3526,575 @@ double svm_predict(const svm_model *model, const svm_node *x)
 	return pred_result;
 }
 
+//
+// Batch prediction
+//
+// Samples are processed in tiles of PREDICT_TILE_ROWS against blocks of
+// PREDICT_TILE_SV SVs. For RBF with dense data the SVs are kept transposed, so
+// the dot products of a sample with a block are contiguous axpys, and the kernel
+// values follow from |x|^2+|sv|^2-2x.sv with a vectorized exp (rbf_cols).
+// All scratch is allocated once per range of tiles, not per sample.
+//
+#define PREDICT_TILE_ROWS 64
+#define PREDICT_TILE_SV 256
+
+void svm_predict_batch(const svm_model *model, const svm_node * const *x, int n, double *predict_labels)
+{
+	if(n <= 0)
+		return;
+
+	int l = model->l;
+	int nr_class = model->nr_class;
+	int dim = model->dense_dim;
+	int nr_dec = (model->param.svm_type == ONE_CLASS ||
+		      model->param.svm_type == EPSILON_SVR ||
+		      model->param.svm_type == NU_SVR) ? 1 : nr_class*(nr_class-1)/2;
+	bool dense_rbf = model->param.kernel_type == RBF && dim > 0;
+
+	// SVs transposed, svt[k*l+i] = SV[i][k], and their squared norms; the model
+	// keeps them unless its SVs are stored as float
+	const double *svt = model->SV_dense_t;
+	const double *sv_square = model->sv_square;
+	double *svt_space = NULL;
+	double *sv_square_space = NULL;
+	if(dense_rbf && model->SV_dense_f)
+	{
+		svt_space = Malloc(double,(size_t)dim*l);
+		sv_square_space = Malloc(double,l);
+		for(int i=0;i<l;i++)
+		{
+			const float *sv = &model->SV_dense_f[(size_t)i*dim];
+			for(int k=0;k<dim;k++)
+				svt_space[(size_t)k*l+i] = sv[k];
+			sv_square_space[i] = dot_dense(sv,sv,dim);
+		}
+		svt = svt_space;
+		sv_square = sv_square_space;
+	}
+
+	rbf_cols_function rbf_cols = get_rbf_cols_function();
+	double gamma = model->param.gamma;
+	int nr_tile = (n+PREDICT_TILE_ROWS-1)/PREDICT_TILE_ROWS;
+	int nr_thread = svm_resolve_nr_thread(model->param.nr_thread);
+
+	parallel_for(0,nr_tile,1,nr_thread,[&](int tile_begin, int tile_end) {
+		double *kvalue = Malloc(double,(size_t)PREDICT_TILE_ROWS*l);
+		double *xd = Malloc(double,(size_t)PREDICT_TILE_ROWS*max(dim,1));
+		double *xx = Malloc(double,PREDICT_TILE_ROWS);
+		bool *is_dense = Malloc(bool,PREDICT_TILE_ROWS);
+		double *dec_values = Malloc(double,nr_dec);
+		int *start = Malloc(int,nr_class);
+		int *vote = Malloc(int,nr_class);
+		fill_class_start(model,start);
+
+		for(int tile=tile_begin;tile<tile_end;tile++)
+		{
+			int row_begin = tile*PREDICT_TILE_ROWS;
+			int rows = min(n-row_begin,PREDICT_TILE_ROWS);
+
+			for(int t=0;t<rows;t++)
+			{
+				const svm_node *px = x[row_begin+t];
+				double *xt = &xd[(size_t)t*dim];
+				is_dense[t] = dense_rbf && get_dense_row(model,px,xt);
+				if(is_dense[t])
+					xx[t] = dot_dense(xt,xt,dim);
+				else
+				{
+					double *kt = &kvalue[(size_t)t*l];
+					for(int i=0;i<l;i++)
+						kt[i] = sv_k_function(model,i,px,NULL);
+				}
+			}
+
+			// every row of the tile reads the same SV block while it is in cache
+			for(int b=0;dense_rbf && b<l;b+=PREDICT_TILE_SV)
+			{
+				int bn = min(l-b,PREDICT_TILE_SV);
+				for(int t=0;t<rows;t++)
+				{
+					if(!is_dense[t])
+						continue;
+					rbf_cols(&xd[(size_t)t*dim],svt+b,l,dim,xx[t],sv_square+b,gamma,bn,&kvalue[(size_t)t*l+b]);
+				}
+			}
+
+			for(int t=0;t<rows;t++)
+				predict_labels[row_begin+t] = predict_from_kvalue(model,&kvalue[(size_t)t*l],start,vote,dec_values);
+		}
+
+		free(kvalue);
+		free(xd);
+		free(xx);
+		free(is_dense);
+		free(dec_values);
+		free(start);
+		free(vote);
+	});
+
+	free(svt_space);
+	free(sv_square_space);
+}
+
+//
+// Prediction context
+//
+// Scratch for single sample prediction against one model, allocated once so
+// that svm_predict_with_context does no malloc. A context belongs to one thread;
+// the model itself is only read, so any number of threads can predict with their
+// own contexts at the same time without locking.
+//
+struct svm_predict_context
+{
+	const svm_model *model;
+	double *kvalue;			// kvalue[l]
+	int *start;			// first SV of each class
+	int *vote;
+	double *dec_values;
+	double *xd;			// dense copy of x
+	float *xf;			// float copy of x for float SVs
+	const float **sv_rows_f;	// float SV rows for rbf_rows_f
+	rbf_rows_float_function rbf_rows_f;
+};
+
+svm_predict_context *svm_predict_context_create(const svm_model *model)
+{
+	int nr_class = model->nr_class;
+	int nr_dec = (model->param.svm_type == ONE_CLASS ||
+		      model->param.svm_type == EPSILON_SVR ||
+		      model->param.svm_type == NU_SVR) ? 1 : nr_class*(nr_class-1)/2;
+
+	svm_predict_context *ctx = Malloc(svm_predict_context,1);
+	ctx->model = model;
+	ctx->kvalue = Malloc(double,max(model->l,1));
+	ctx->start = Malloc(int,nr_class);
+	ctx->vote = Malloc(int,nr_class);
+	ctx->dec_values = Malloc(double,nr_dec);
+	ctx->xd = Malloc(double,DENSE_PREDICT_MAX_DIM);
+	ctx->xf = NULL;
+	ctx->sv_rows_f = NULL;
+	ctx->rbf_rows_f = NULL;
+	fill_class_start(model,ctx->start);
+
+	if(model->param.kernel_type == RBF && model->SV_dense_f)
+	{
+		ctx->xf = Malloc(float,DENSE_PREDICT_MAX_DIM);
+		ctx->sv_rows_f = Malloc(const float *,model->l);
+		for(int i=0;i<model->l;i++)
+			ctx->sv_rows_f[i] = &model->SV_dense_f[(size_t)i*model->dense_dim];
+		ctx->rbf_rows_f = get_rbf_rows_float_function();
+	}
+	return ctx;
+}
+
+void svm_predict_context_free(svm_predict_context *ctx)
+{
+	if(ctx == NULL)
+		return;
+	free(ctx->kvalue);
+	free(ctx->start);
+	free(ctx->vote);
+	free(ctx->dec_values);
+	free(ctx->xd);
+	free(ctx->xf);
+	free(ctx->sv_rows_f);
+	free(ctx);
+}
+
+double svm_predict_values_with_context(svm_predict_context *ctx, const svm_node *x, double* dec_values)
+{
+	const svm_model *model = ctx->model;
+	int l = model->l;
+	const double *xd = get_dense_row(model,x,ctx->xd) ? ctx->xd : NULL;
+
+	if(xd && ctx->sv_rows_f)
+	{
+		// xd already holds float values, so this copy is exact
+		for(int k=0;k<model->dense_dim;k++)
+			ctx->xf[k] = (float)xd[k];
+		ctx->rbf_rows_f(ctx->xf,ctx->sv_rows_f,model->dense_dim,model->param.gamma,l,ctx->kvalue);
+	}
+	else
+		sv_k_values(model,x,xd,ctx->kvalue);
+
+	return predict_from_kvalue(model,ctx->kvalue,ctx->start,ctx->vote,dec_values);
+}
+
+double svm_predict_with_context(svm_predict_context *ctx, const svm_node *x)
+{
+	return svm_predict_values_with_context(ctx,x,ctx->dec_values);
+}
+
+//
+// SV reduction
+//
+// For RBF |phi(x)| = 1, so the decision values of w = sum alpha_i phi(x_i) and a
+// reduced w' differ by at most |w-w'| at any x. SVs of the same class are merged
+// in pairs (Nguyen and Ho, 2005): the one with the smallest |alpha| goes with
+// the partner that changes w least, into z = h*x_i+(1-h)*x_j with the best
+// coefficient for that z. After the merges the coefficients of the remaining
+// SVs are refitted to w by least squares, which usually lowers |w-w'| by orders
+// of magnitude; so the merges are recorded down to nr_sv once, and the longest
+// prefix of them whose refitted model stays within max_loss is searched. A refit
+// of m SVs is an O(m^3) Cholesky on one thread, so the search does not go past
+// REDUCE_MAX_GROWTH*nr_sv SVs.
+//
+#define REDUCE_GOLDEN_ITER 40
+#define REDUCE_MAX_GROWTH 4		// most SVs tried, in multiples of nr_sv
+#define REDUCE_RIDGE 1e-8
+#define REDUCE_SEARCH_TOL 64		// stop the search within 1/64 of the SVs left
+
+struct reduce_step
+{
+	int i, j;		// z_i becomes the merge of z_i and z_j, z_j is dropped
+	double beta;		// coefficient of the merge
+};
+
+// |alpha_i| K(z,x_i) + |alpha_j| K(z,x_j) for z = h*x_i+(1-h)*x_j, log_k = log K(x_i,x_j)
+static inline double merge_weight(double log_k, double ai, double aj, double h)
+{
+	return ai*exp(log_k*(1-h)*(1-h)) + aj*exp(log_k*h*h);
+}
+
+// |a_i phi(x_i) + a_j phi(x_j) - beta phi(z)|^2 with the best beta, a_i and a_j of one sign
+static inline double merge_cost(double log_k, double ai, double aj, double weight)
+{
+	return ai*ai + aj*aj + 2*ai*aj*exp(log_k) - weight*weight;
+}
+
+static double merge_best_h(double log_k, double ai, double aj)
+{
+	const double ratio = 0.6180339887498949;
+	double low = 0, high = 1;
+	double h1 = high - ratio*(high-low), h2 = low + ratio*(high-low);
+	double w1 = merge_weight(log_k,ai,aj,h1), w2 = merge_weight(log_k,ai,aj,h2);
+	for(int iter=0;iter<REDUCE_GOLDEN_ITER;iter++)
+	{
+		if(w1 < w2)
+		{
+			low = h1; h1 = h2; w1 = w2;
+			h2 = low + ratio*(high-low);
+			w2 = merge_weight(log_k,ai,aj,h2);
+		}
+		else
+		{
+			high = h2; h2 = h1; w2 = w1;
+			h1 = high - ratio*(high-low);
+			w1 = merge_weight(log_k,ai,aj,h1);
+		}
+	}
+	return (low+high)/2;
+}
+
+// solve (A + ridge*I) x = b for symmetric positive definite A by Cholesky, A is overwritten
+static bool solve_spd(double *A, int m, const double *b, double *x)
+{
+	for(int j=0;j<m;j++)
+	{
+		double *A_j = &A[(size_t)j*m];
+		double d = A_j[j] + REDUCE_RIDGE;
+		for(int k=0;k<j;k++)
+			d -= A_j[k]*A_j[k];
+		if(d <= 0)
+			return false;
+		A_j[j] = sqrt(d);
+		for(int i=j+1;i<m;i++)
+		{
+			double *A_i = &A[(size_t)i*m];
+			double sum = A_i[j];
+			for(int k=0;k<j;k++)
+				sum -= A_i[k]*A_j[k];
+			A_i[j] = sum/A_j[j];
+		}
+	}
+	for(int i=0;i<m;i++)
+	{
+		double sum = b[i];
+		for(int k=0;k<i;k++)
+			sum -= A[(size_t)i*m+k]*x[k];
+		x[i] = sum/A[(size_t)i*m+i];
+	}
+	for(int i=m-1;i>=0;i--)
+	{
+		double sum = x[i];
+		for(int k=i+1;k<m;k++)
+			sum -= A[(size_t)k*m+i]*x[k];
+		x[i] = sum/A[(size_t)i*m+i];
+	}
+	return true;
+}
+
+// |w-w'|^2 = alpha'K alpha - 2 beta'b + beta'K_zz beta, b = K_zx alpha
+static inline double reduce_loss2(double aKa, const double *K_zz, const double *b, const double *beta, int m)
+{
+	double sum = aKa;
+	for(int p=0;p<m;p++)
+	{
+		double Kb = 0;
+		for(int q=0;q<m;q++)
+			Kb += K_zz[(size_t)p*m+q]*beta[q];
+		sum += beta[p]*(Kb - 2*b[p]);
+	}
+	return max(sum,0.0);
+}
+
+// b[p] = sum alpha_k K(x_k,y_p) for m rows y of dim features
+static void reduce_project(const svm_model *model, const double *y, int m, double *b)
+{
+	int l = model->l;
+	int dim = model->dense_dim;
+	const double *alpha = model->sv_coef[0];
+	rbf_cols_function rbf_cols = get_rbf_cols_function();
+	parallel_for(0,m,16,svm_resolve_nr_thread(model->param.nr_thread),[&](int begin, int end) {
+		double *row = Malloc(double,l);
+		for(int p=begin;p<end;p++)
+		{
+			const double *y_p = &y[(size_t)p*dim];
+			rbf_cols(y_p,model->SV_dense_t,l,dim,dot_dense(y_p,y_p,dim),model->sv_square,model->param.gamma,l,row);
+			double sum = 0;
+			for(int k=0;k<l;k++)
+				sum += row[k]*alpha[k];
+			b[p] = sum;
+		}
+		free(row);
+	});
+}
+
+// SVs and coefficients after the first nr_step merges, the m remaining ones compacted to the front
+static int reduce_replay(const svm_model *model, const reduce_step *step, const double *step_z, int nr_step,
+			 double *z, double *beta, int *cls, bool *alive)
+{
+	int l = model->l;
+	int dim = model->dense_dim;
+	memcpy(z,model->SV_dense,sizeof(double)*(size_t)l*dim);
+	for(int i=0;i<l;i++)
+	{
+		beta[i] = model->sv_coef[0][i];
+		cls[i] = (i < model->nSV[0]) ? 0 : 1;
+		alive[i] = true;
+	}
+	for(int s=0;s<nr_step;s++)
+	{
+		memcpy(&z[(size_t)step[s].i*dim],&step_z[(size_t)s*dim],sizeof(double)*dim);
+		beta[step[s].i] = step[s].beta;
+		alive[step[s].j] = false;
+	}
+
+	int m = 0;
+	for(int i=0;i<l;i++)
+		if(alive[i])
+		{
+			memmove(&z[(size_t)m*dim],&z[(size_t)i*dim],sizeof(double)*dim);
+			beta[m] = beta[i];
+			cls[m] = cls[i];
+			++m;
+		}
+	return m;
+}
+
+// refit beta[0..m-1] of the SVs z to w if that is closer, return |w-w'|^2
+static double reduce_refit(const svm_model *model, double aKa, const double *z, int m, double *beta)
+{
+	int dim = model->dense_dim;
+	double gamma = model->param.gamma;
+	double *K_zz = Malloc(double,(size_t)m*m);
+	for(int p=0;p<m;p++)
+	{
+		K_zz[(size_t)p*m+p] = 1;
+		for(int q=0;q<p;q++)
+			K_zz[(size_t)p*m+q] = K_zz[(size_t)q*m+p] =
+				exp(-gamma*dist2_dense(&z[(size_t)p*dim],&z[(size_t)q*dim],dim));
+	}
+	double *b = Malloc(double,m);
+	reduce_project(model,z,m,b);
+
+	double loss2 = reduce_loss2(aKa,K_zz,b,beta,m);
+	double *refit = Malloc(double,m);
+	double *chol = Malloc(double,(size_t)m*m);
+	memcpy(chol,K_zz,sizeof(double)*(size_t)m*m);
+	if(solve_spd(chol,m,b,refit))
+	{
+		double refit_loss2 = reduce_loss2(aKa,K_zz,b,refit,m);
+		if(refit_loss2 < loss2)
+		{
+			memcpy(beta,refit,sizeof(double)*m);
+			loss2 = refit_loss2;
+		}
+	}
+	free(K_zz);
+	free(b);
+	free(refit);
+	free(chol);
+	return loss2;
+}
+
+svm_model *svm_reduce_model(const svm_model *model, int nr_sv, double max_loss, double *loss)
+{
+	if((model->param.svm_type != C_SVC && model->param.svm_type != NU_SVC) ||
+	   model->nr_class != 2 || model->sv_square == NULL)
+		return NULL;
+
+	int l = model->l;
+	int dim = model->dense_dim;
+	double gamma = model->param.gamma;
+	double *z = Malloc(double,(size_t)l*dim);
+	double *beta = Malloc(double,l);
+	int *cls = Malloc(int,l);
+	bool *alive = Malloc(bool,l);
+	reduce_replay(model,NULL,NULL,0,z,beta,cls,alive);
+
+	// merges down to nr_sv, or while both classes have two SVs
+	reduce_step *step = Malloc(reduce_step,l);
+	double *step_z = Malloc(double,(size_t)l*dim);
+	int nr_step = 0;
+	int nr_alive[2] = {model->nSV[0],model->nSV[1]};
+	while(l-nr_step > max(nr_sv,2))
+	{
+		int i = -1;
+		for(int t=0;t<l;t++)
+			if(alive[t] && nr_alive[cls[t]] > 1 && (i < 0 || fabs(beta[t]) < fabs(beta[i])))
+				i = t;
+		if(i < 0)
+			break;
+
+		// partner by the cost at h = |beta_i|/(|beta_i|+|beta_j|), an upper bound of the best
+		const double *z_i = &z[(size_t)i*dim];
+		double ai = fabs(beta[i]);
+		int j = -1;
+		double best = INF, log_k_ij = 0;
+		for(int t=0;t<l;t++)
+		{
+			if(!alive[t] || t == i || cls[t] != cls[i])
+				continue;
+			double aj = fabs(beta[t]);
+			double log_k = -gamma*dist2_dense(z_i,&z[(size_t)t*dim],dim);
+			double cost = merge_cost(log_k,ai,aj,merge_weight(log_k,ai,aj,ai/(ai+aj)));
+			if(cost < best)
+			{
+				best = cost;
+				j = t;
+				log_k_ij = log_k;
+			}
+		}
+
+		double aj = fabs(beta[j]);
+		double h = merge_best_h(log_k_ij,ai,aj);
+		double weight = merge_weight(log_k_ij,ai,aj,h);
+		double *z_new = &step_z[(size_t)nr_step*dim];
+		for(int k=0;k<dim;k++)
+			z_new[k] = h*z_i[k] + (1-h)*z[(size_t)j*dim+k];
+		step[nr_step].i = i;
+		step[nr_step].j = j;
+		step[nr_step].beta = (beta[i] > 0) ? weight : -weight;
+
+		memcpy(&z[(size_t)i*dim],z_new,sizeof(double)*dim);
+		beta[i] = step[nr_step].beta;
+		alive[j] = false;
+		--nr_alive[cls[j]];
+		++nr_step;
+	}
+
+	double aKa = 0;
+	{
+		double *aK = Malloc(double,l);
+		reduce_project(model,model->SV_dense,l,aK);
+		for(int k=0;k<l;k++)
+			aKa += model->sv_coef[0][k]*aK[k];
+		free(aK);
+	}
+
+	// the loss grows with the number of merges; find the most merges within max_loss,
+	// starting from the fewest SVs where a refit is cheapest. If even the most SVs
+	// tried miss max_loss, no merge is kept
+	int min_probe = min(max(l-REDUCE_MAX_GROWTH*max(nr_sv,2),0),nr_step);
+	int good = 0, bad = nr_step+1;
+	int probe = nr_step;
+	bool reachable = true;
+	while(probe > good)
+	{
+		int m = reduce_replay(model,step,step_z,probe,z,beta,cls,alive);
+		if(reduce_refit(model,aKa,z,m,beta) <= max_loss*max_loss)
+			good = probe;
+		else
+			bad = probe;
+		if(good > 0 || bad-good <= 1)
+			break;
+		if(probe == min_probe)
+		{
+			reachable = false;
+			break;
+		}
+		probe = max(l-2*(l-probe),min_probe);	// twice the SVs
+	}
+	while(reachable && bad-good > max(1,(l-good)/REDUCE_SEARCH_TOL))
+	{
+		probe = (good+bad)/2;
+		int m = reduce_replay(model,step,step_z,probe,z,beta,cls,alive);
+		if(reduce_refit(model,aKa,z,m,beta) <= max_loss*max_loss)
+			good = probe;
+		else
+			bad = probe;
+	}
+
+	int m = reduce_replay(model,step,step_z,good,z,beta,cls,alive);
+	double loss2 = (good > 0) ? reduce_refit(model,aKa,z,m,beta) : 0;
+	if(loss)
+		*loss = sqrt(loss2);
+	if(reachable)
+		info("SV reduction: %d -> %d SVs, |w-w'| = %g\n",l,m,sqrt(loss2));
+	else
+		info("SV reduction: %d SVs exceed |w-w'| = %g, keeping all %d\n",l-min_probe,max_loss,l);
+
+	svm_model *reduced = Malloc(svm_model,1);
+	reduced->param = model->param;
+	reduced->param.kernel_matrix = NULL;
+	reduced->nr_class = 2;
+	reduced->l = m;
+	reduced->SV = Malloc(svm_node *,m);
+	svm_node *x_space = Malloc(svm_node,(size_t)m*(dim+1));
+	reduced->sv_coef = Malloc(double *,1);
+	reduced->sv_coef[0] = Malloc(double,m);
+	reduced->nSV = Malloc(int,2);
+	reduced->nSV[0] = reduced->nSV[1] = 0;
+	for(int p=0;p<m;p++)
+	{
+		reduced->SV[p] = &x_space[(size_t)p*(dim+1)];
+		for(int k=0;k<dim;k++)
+		{
+			reduced->SV[p][k].index = model->dense_base+k;
+			reduced->SV[p][k].value = z[(size_t)p*dim+k];
+		}
+		reduced->SV[p][dim].index = -1;
+		reduced->sv_coef[0][p] = beta[p];
+		++reduced->nSV[cls[p]];
+	}
+	reduced->rho = Malloc(double,1);
+	reduced->rho[0] = model->rho[0];
+	reduced->label = Malloc(int,2);
+	reduced->label[0] = model->label[0];
+	reduced->label[1] = model->label[1];
+	reduced->probA = NULL;
+	reduced->probB = NULL;
+	if(model->probA && model->probB)
+	{
+		reduced->probA = Malloc(double,1);
+		reduced->probB = Malloc(double,1);
+		reduced->probA[0] = model->probA[0];
+		reduced->probB[0] = model->probB[0];
+	}
+	reduced->sv_indices = NULL;
+	reduced->free_sv = 1;	// SV[0] is x_space
+	build_dense_sv(reduced);
+
+	free(z);
+	free(beta);
+	free(cls);
+	free(alive);
+	free(step);
+	free(step_z);
+	return reduced;
+}
+
 double svm_predict_probability(
 	const svm_model *model, const svm_node *x, double *prob_estimates)
 {
@@ -2777,6 +4283,11 @@ bool read_model_header(FILE *fp, svm_model* model)
 	param.nr_weight = 0;
 	param.weight_label = NULL;
 	param.weight = NULL;
+	param.nr_thread = 0;
+	param.nr_prob_fold = 0;
+	param.seed = 0;
+	param.kernel_matrix = NULL;
+	param.float_storage = 0;	// the model file keeps the SVs in full precision
 
 	char cmd[81];
 	while(1)
@@ -2989,6 +4500,7 @@ svm_model *svm_load_model(const char *model_file_name)
 		return NULL;
 
 	model->free_sv = 1;	// XXX
+	build_dense_sv(model);
 	return model;
 }
 
@@ -3025,6 +4537,16 @@ void svm_free_model_content(svm_model* model_ptr)
 
 	free(model_ptr->nSV);
 	model_ptr->nSV = NULL;
+
+	free(model_ptr->SV_dense);
+	model_ptr->SV_dense = NULL;
+	free(model_ptr->SV_dense_f);
+	model_ptr->SV_dense_f = NULL;
+	free(model_ptr->SV_dense_t);
+	model_ptr->SV_dense_t = NULL;
+	free(model_ptr->sv_square);
+	model_ptr->sv_square = NULL;
+	model_ptr->dense_dim = 0;
 }
 
 void svm_free_and_destroy_model(svm_model** model_ptr_ptr)
@@ -3076,9 +4598,24 @@ const char *svm_check_parameter(const svm_problem *prob, const svm_parameter *pa
 	if(param->cache_size <= 0)
 		return "cache_size <= 0";
 
+	if(param->nr_thread < 0)
+		return "nr_thread < 0";
+
+	if(param->nr_prob_fold < 0 || param->nr_prob_fold == 1)
+		return "nr_prob_fold must be 0 or >= 2";
+
 	if(param->eps <= 0)
 		return "eps <= 0";
 
+	if(prob->W)
+	{
+		if(svm_type != C_SVC)
+			return "instance weights are only supported for C_SVC";
+		for(int i=0;i<prob->l;i++)
+			if(prob->W[i] <= 0)
+				return "instance weight <= 0";
+	}
+
 	if(svm_type == C_SVC ||
 	   svm_type == EPSILON_SVR ||
 	   svm_type == NU_SVR)
@@ -20,11 +20,15 @@ struct svm_problem
 	int l;
 	double *y;
 	struct svm_node **x;
+	double *W;	/* instance weights scaling C of each row (C_SVC only), NULL for all 1 */
 };
 
 enum { C_SVC, NU_SVC, ONE_CLASS, EPSILON_SVR, NU_SVR };	/* svm_type */
 enum { LINEAR, POLY, RBF, SIGMOID, PRECOMPUTED }; /* kernel_type */
 
+struct svm_kernel_matrix;
+struct svm_predict_context;
+
 struct svm_parameter
 {
 	int svm_type;
@@ -44,6 +48,13 @@ struct svm_parameter
 	double p;	/* for EPSILON_SVR */
 	int shrinking;	/* use the shrinking heuristics */
 	int probability; /* do probability estimates */
+	int nr_thread;	/* training threads, 0 for SVM_NUM_THREADS or all */
+	int nr_prob_fold;	/* folds for probability estimates, 0 for SVM_PROB_FOLDS or 5 */
+	unsigned int seed;	/* for the shuffles of probability estimates */
+	const struct svm_kernel_matrix *kernel_matrix;	/* kernel of the training rows, NULL to compute it */
+	int float_storage;	/* dense feature rows as float instead of double, distances are still summed in double.
+			   This halves what the kernel reads per row, it does not save memory: the rows are
+			   an extra copy next to the svm_node arrays, which are kept, as is model->SV */
 };
 
 //
@@ -69,10 +80,27 @@ struct svm_model
 	/* XXX */
 	int free_sv;		/* 1 if svm_model is created by svm_load_model*/
 				/* 0 if svm_model is created by svm_train */
+
+	/* dense copy of SV for prediction, built by svm_train and svm_load_model */
+	int dense_dim;		/* #features of each SV, 0 if SVs are sparse */
+	int dense_base;		/* index of the first feature */
+	double *SV_dense;	/* SV_dense[l*dense_dim], NULL if param.float_storage */
+	float *SV_dense_f;	/* SV_dense_f[l*dense_dim] if param.float_storage, a copy of SV */
+	double *SV_dense_t;	/* SV_dense transposed, SV_dense_t[k*l+i], for RBF only */
+	double *sv_square;	/* |SV[i]|^2, for RBF only */
 };
 
 struct svm_model *svm_train(const struct svm_problem *prob, const struct svm_parameter *param);
+/* models[k] for C[k], k = 0,...,nr_C-1; C_SVC warm starts each solve from the previous one */
+void svm_train_path(const struct svm_problem *prob, const struct svm_parameter *param, int nr_C, const double *C, struct svm_model **models);
 void svm_cross_validation(const struct svm_problem *prob, const struct svm_parameter *param, int nr_fold, double *target);
+void svm_cross_validation_seed(const struct svm_problem *prob, const struct svm_parameter *param, int nr_fold, unsigned int seed, double *target);
+
+/* kernel values of every pair of rows in prob, shared read only through param->kernel_matrix
+   by trainings on any subset of those rows with the same kernel parameters */
+struct svm_kernel_matrix *svm_kernel_matrix_create(const struct svm_problem *prob, const struct svm_parameter *param);
+void svm_kernel_matrix_free(struct svm_kernel_matrix *km);
+double svm_kernel_matrix_size(int l);	/* in MB */
 
 int svm_save_model(const char *model_file_name, const struct svm_model *model);
 struct svm_model *svm_load_model(const char *model_file_name);
@@ -86,8 +114,22 @@ double svm_get_svr_probability(const struct svm_model *model);
 
 double svm_predict_values(const struct svm_model *model, const struct svm_node *x, double* dec_values);
 double svm_predict(const struct svm_model *model, const struct svm_node *x);
+/* predict_labels[k] = svm_predict(model,x[k]) for k = 0,...,n-1, tiled over samples and SVs */
+void svm_predict_batch(const struct svm_model *model, const struct svm_node * const *x, int n, double *predict_labels);
+
+/* per thread scratch for allocation free single sample prediction, see svm.cpp */
+struct svm_predict_context *svm_predict_context_create(const struct svm_model *model);
+void svm_predict_context_free(struct svm_predict_context *ctx);
+double svm_predict_values_with_context(struct svm_predict_context *ctx, const struct svm_node *x, double* dec_values);
+double svm_predict_with_context(struct svm_predict_context *ctx, const struct svm_node *x);
 double svm_predict_probability(const struct svm_model *model, const struct svm_node *x, double* prob_estimates);
 
+/* binary RBF model with as few SVs as possible, but not fewer than nr_sv, whose decision value differs
+   from model's by at most max_loss for any x; the bound reached is returned in loss if not NULL.
+   Only models of up to 4*nr_sv SVs are tried, if none of them is within max_loss the result is a
+   copy of model with all its SVs and loss 0. NULL if model can not be reduced */
+struct svm_model *svm_reduce_model(const struct svm_model *model, int nr_sv, double max_loss, double *loss);
+
 void svm_free_model_content(struct svm_model *model_ptr);
 void svm_free_and_destroy_model(struct svm_model **model_ptr_ptr);
 void svm_destroy_param(struct svm_parameter *param);
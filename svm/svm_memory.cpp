@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include "svm_memory.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE		(2u<<20)
+#define LARGE_HEADER		64		// keeps the data cache line aligned
+
+enum { HUGEPAGE_OFF, HUGEPAGE_THP, HUGEPAGE_HUGETLB };
+enum { BACKING_MALLOC, BACKING_MMAP, BACKING_VIRTUAL };
+
+// stored in front of every buffer
+struct large_header
+{
+	void *base;		// start of the mapping or malloc block
+	size_t len;		// length of the mapping
+	int backing;
+};
+
+static int get_hugepage_mode()
+{
+	const char *env = getenv("SVM_HUGEPAGES");
+	if(env == NULL)
+		return HUGEPAGE_OFF;
+	if(strcmp(env,"thp") == 0)
+		return HUGEPAGE_THP;
+	if(strcmp(env,"hugetlb") == 0)
+		return HUGEPAGE_HUGETLB;
+	return HUGEPAGE_OFF;
+}
+
+static size_t round_up(size_t size, size_t align)
+{
+	return (size + align - 1) / align * align;
+}
+
+#if defined(__linux__)
+static void *map_huge(size_t total, int mode, size_t *len)
+{
+	void *base;
+#ifdef MAP_HUGETLB
+	if(mode == HUGEPAGE_HUGETLB)
+	{
+		*len = round_up(total,HUGE_PAGE_SIZE);
+		base = mmap(NULL,*len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+		if(base != MAP_FAILED)
+			return base;
+	}
+#endif
+
+	// map one huge page more and trim both ends so the buffer starts on a huge page
+	size_t want = round_up(total,HUGE_PAGE_SIZE);
+	char *raw = (char *)mmap(NULL,want+HUGE_PAGE_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if(raw == MAP_FAILED)
+		return NULL;
+	char *aligned = (char *)round_up((size_t)raw,HUGE_PAGE_SIZE);
+	if(aligned > raw)
+		munmap(raw,aligned-raw);
+	size_t tail = (raw+want+HUGE_PAGE_SIZE) - (aligned+want);
+	if(tail > 0)
+		munmap(aligned+want,tail);
+#ifdef MADV_HUGEPAGE
+	madvise(aligned,want,MADV_HUGEPAGE);
+#endif
+	*len = want;
+	return aligned;
+}
+#elif defined(_WIN32)
+static void *map_huge(size_t total, int mode, size_t *len)
+{
+	(void)mode;
+	size_t large = GetLargePageMinimum();
+	if(large == 0)
+		return NULL;
+	*len = round_up(total,large);
+	// fails without SeLockMemoryPrivilege, the caller falls back to malloc
+	return VirtualAlloc(NULL,*len,MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES,PAGE_READWRITE);
+}
+#else
+static void *map_huge(size_t total, int mode, size_t *len)
+{
+	(void)total;
+	(void)mode;
+	(void)len;
+	return NULL;
+}
+#endif
+
+void *svm_alloc_large(size_t size)
+{
+	size_t total = size + LARGE_HEADER;
+	int mode = get_hugepage_mode();
+	large_header header;
+	header.base = NULL;
+	header.len = 0;
+	header.backing = BACKING_MALLOC;
+
+	if(mode != HUGEPAGE_OFF && total >= HUGE_PAGE_SIZE)
+	{
+		header.base = map_huge(total,mode,&header.len);
+#ifdef _WIN32
+		header.backing = BACKING_VIRTUAL;
+#else
+		header.backing = BACKING_MMAP;
+#endif
+	}
+	if(header.base == NULL)
+	{
+		header.base = malloc(total);
+		header.len = total;
+		header.backing = BACKING_MALLOC;
+		if(header.base == NULL)
+			return NULL;
+	}
+
+	char *data = (char *)header.base + LARGE_HEADER;
+	memcpy(header.base,&header,sizeof(header));
+	return data;
+}
+
+void svm_free_large(void *ptr)
+{
+	if(ptr == NULL)
+		return;
+	large_header header;
+	memcpy(&header,(char *)ptr - LARGE_HEADER,sizeof(header));
+
+	switch(header.backing)
+	{
+#if defined(__linux__)
+		case BACKING_MMAP:
+			munmap(header.base,header.len);
+			break;
+#elif defined(_WIN32)
+		case BACKING_VIRTUAL:
+			VirtualFree(header.base,0,MEM_RELEASE);
+			break;
+#endif
+		default:
+			free(header.base);
+			break;
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef _LIBSVM_MEMORY_H
+#define _LIBSVM_MEMORY_H
+
+#include <stddef.h>
+
+//
+// Large buffers: kernel cache slab, dense training rows, dataset arenas
+//
+// SVM_HUGEPAGES=off|thp|hugetlb selects the backing pages (default off, plain malloc):
+//   thp      anonymous mapping aligned to 2MB with madvise(MADV_HUGEPAGE);
+//            on Windows, large pages when the process may lock memory
+//   hugetlb  mmap with MAP_HUGETLB from the reserved pool, thp if that fails
+//
+// Buffers below the huge page size always come from malloc.
+//
+void *svm_alloc_large(size_t size);
+void svm_free_large(void *ptr);
+
+#endif /* _LIBSVM_MEMORY_H */
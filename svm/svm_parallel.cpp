@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <atomic>
+#include "svm_parallel.h"
+#include "../thread_pool.h"
+
+void svm_parallel_for(int begin, int end, int grain, int nr_thread,
+		      void (*body)(void *ctx, int begin, int end), void *ctx)
+{
+	int n = end - begin;
+	if(grain < 1)
+		grain = 1;
+	int nr_chunk = n/grain;
+	if(nr_chunk > nr_thread)
+		nr_chunk = nr_thread;
+	if(nr_chunk <= 1)
+	{
+		if(n > 0)
+			body(ctx,begin,end);
+		return;
+	}
+
+	size_t chunk = (size_t)((n + nr_chunk - 1)/nr_chunk);
+	THREADPOOL->ParallelFor((size_t)begin, (size_t)end, chunk, [body, ctx](size_t chunkBegin, size_t chunkEnd) {
+		body(ctx,(int)chunkBegin,(int)chunkEnd);
+	});
+}
+
+void svm_parallel_for_each(int n, int nr_thread, void (*body)(void *ctx, int k), void *ctx)
+{
+	if(nr_thread > n)
+		nr_thread = n;
+	if(nr_thread <= 1)
+	{
+		for(int k=0;k<n;k++)
+			body(ctx,k);
+		return;
+	}
+
+	std::atomic<int> next(0);
+	THREADPOOL->ParallelFor(0, (size_t)nr_thread, 1, [body, ctx, n, &next](size_t, size_t) {
+		for(int k=next++;k<n;k=next++)
+			body(ctx,k);
+	});
+}
+
+int svm_resolve_nr_thread(int nr_thread)
+{
+	int max_thread = (int)THREADPOOL->NumOfThreads();
+	if(nr_thread <= 0)
+	{
+		const char *env = getenv("SVM_NUM_THREADS");
+		nr_thread = env ? atoi(env) : 0;
+		if(nr_thread <= 0)
+			nr_thread = max_thread;
+	}
+	return nr_thread < max_thread ? nr_thread : max_thread;
+}
+
+void svm_setup_thread_pool()
+{
+	const char *env = getenv("SVM_PIN_THREADS");
+	ThreadPool::SetPinWorkers(env != NULL && atoi(env) != 0);
+}
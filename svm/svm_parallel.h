@@ -0,0 +1,47 @@
+#ifndef _LIBSVM_PARALLEL_H
+#define _LIBSVM_PARALLEL_H
+
+//
+// Bridge from libsvm to the process wide thread pool
+//
+// body(ctx,begin,end) is called for [begin,end) split into chunks of at least
+// grain elements, at most nr_thread chunks run at the same time.
+//
+void svm_parallel_for(int begin, int end, int grain, int nr_thread,
+		      void (*body)(void *ctx, int begin, int end), void *ctx);
+
+// body(ctx,k) for k = 0,...,n-1, at most nr_thread at the same time; every idle
+// thread claims the next k, so put the largest items first
+void svm_parallel_for_each(int n, int nr_thread, void (*body)(void *ctx, int k), void *ctx);
+
+// number of threads to use for a request of nr_thread (<= 0 means automatic:
+// SVM_NUM_THREADS if set, otherwise every thread of the pool)
+int svm_resolve_nr_thread(int nr_thread);
+
+// SVM_PIN_THREADS=1 pins worker i of the pool to core i+1 and leaves core 0 to the
+// caller. This is core affinity only, the NUMA topology is not read. Call it before
+// anything else uses the pool, it has no effect once the pool runs
+void svm_setup_thread_pool();
+
+template <class Body> static void svm_parallel_body(void *ctx, int begin, int end)
+{
+	(*(const Body *)ctx)(begin,end);
+}
+
+template <class Body> static inline void parallel_for(int begin, int end, int grain, int nr_thread,
+						      const Body& body)
+{
+	svm_parallel_for(begin,end,grain,nr_thread,&svm_parallel_body<Body>,(void *)&body);
+}
+
+template <class Body> static void svm_parallel_item(void *ctx, int k)
+{
+	(*(const Body *)ctx)(k);
+}
+
+template <class Body> static inline void parallel_for_each(int n, int nr_thread, const Body& body)
+{
+	svm_parallel_for_each(n,nr_thread,&svm_parallel_item<Body>,(void *)&body);
+}
+
+#endif /* _LIBSVM_PARALLEL_H */
@@ -0,0 +1,11 @@
+﻿#pragma once
+
+// fopen_s of MSVC for the sources under test, other compilers only
+#include <stdio.h>
+#include <errno.h>
+
+static inline int fopen_s(FILE **fp, const char *path, const char *mode)
+{
+	*fp = fopen(path, mode);
+	return (*fp == nullptr) ? errno : 0;
+}
@@ -0,0 +1,46 @@
+﻿#include <math.h>
+#include <string.h>
+#include "grid_search.h"
+#include "test_util.h"
+#include "test_problem.h"
+
+using namespace std;
+
+static void TestHalvingFindsGridOptimum()
+{
+	// The last halving round scores its survivors exactly like the full grid, so the
+	// point it picks must score as well in the full grid as the full grid's best.
+	// Points of equal accuracy may differ in the last bits of the mean
+	TestProblem problem;
+	MakeProblem(200, 4, 2, problem);
+
+	svm_parameter param;
+	memset(&param, 0, sizeof(param));
+	param.svm_type = C_SVC;
+	param.kernel_type = RBF;
+	param.cache_size = 100;
+	param.eps = 1e-3;
+	param.shrinking = 1;
+
+	GridSearch full, halving;
+	CHECK(full.Run(problem.prob, param));
+	CHECK(halving.RunHalving(problem.prob, param));
+
+	const GridSearchScore &best = halving.Best();
+	bool found = false;
+	for (size_t p = 0; p < full.Scores().size(); p++) {
+		const GridSearchScore &score = full.Scores()[p];
+		if (score.C == best.C && score.gamma == best.gamma) {
+			found = true;
+			CHECK(score.meanScore == best.meanScore);
+			CHECK(fabs(score.meanScore - full.Best().meanScore) < 1e-9);
+		}
+	}
+	CHECK(found);
+}
+
+int main()
+{
+	TestHalvingFindsGridOptimum();
+	return gNumOfFailures;
+}
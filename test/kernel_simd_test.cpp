@@ -0,0 +1,141 @@
+﻿#include <math.h>
+#include <stdlib.h>
+#include <vector>
+#include "kernel_simd.h"
+#include "test_util.h"
+
+using namespace std;
+
+// The path under test is chosen once per process, ctest runs this with SVM_SIMD=scalar|avx2|avx512
+
+static double Uniform(double low, double high)
+{
+	return low + (high - low) * rand() / RAND_MAX;
+}
+
+static bool Near(double value, double expected)
+{
+	if (isnan(expected)) {
+		return isnan(value) != 0;
+	}
+	return fabs(value - expected) <= 1e-12 * fabs(expected) + 1e-300;
+}
+
+static void TestRows()
+{
+	rbf_rows_function rbf_rows = get_rbf_rows_function();
+	rbf_rows_float_function rbf_rows_float = get_rbf_rows_float_function();
+
+	for (int dim = 1; dim <= 24; dim += 5) {
+		for (int n = 1; n <= 19; n++) {
+			vector<double> x(dim), data(n * dim);
+			vector<float> xf(dim), dataf(n * dim);
+			vector<const double *> rows(n);
+			vector<const float *> rowsf(n);
+			for (int k = 0; k < dim; k++) {
+				x[k] = Uniform(-3, 3);
+				xf[k] = (float)x[k];
+			}
+			for (int j = 0; j < n * dim; j++) {
+				data[j] = Uniform(-3, 3);
+				dataf[j] = (float)data[j];
+			}
+			for (int j = 0; j < n; j++) {
+				rows[j] = &data[j * dim];
+				rowsf[j] = &dataf[j * dim];
+			}
+
+			double gamma = Uniform(0.01, 2);
+			vector<double> out(n), expected(n);
+			rbf_rows(x.data(), rows.data(), dim, gamma, n, out.data());
+			rbf_rows_scalar(x.data(), rows.data(), dim, gamma, n, expected.data());
+			bool near = true;
+			for (int j = 0; j < n; j++) {
+				near = near && Near(out[j], expected[j]);
+			}
+			CHECK(near);
+
+			rbf_rows_float(xf.data(), rowsf.data(), dim, gamma, n, out.data());
+			rbf_rows_float_scalar(xf.data(), rowsf.data(), dim, gamma, n, expected.data());
+			near = true;
+			for (int j = 0; j < n; j++) {
+				near = near && Near(out[j], expected[j]);
+			}
+			CHECK(near);
+		}
+	}
+}
+
+static void TestCols()
+{
+	rbf_cols_function rbf_cols = get_rbf_cols_function();
+
+	for (int dim = 1; dim <= 24; dim += 5) {
+		for (int n = 1; n <= 19; n++) {
+			int ld = n + 3;
+			vector<double> x(dim), cols(dim * ld), sq(n, 0);
+			for (int k = 0; k < dim; k++) {
+				x[k] = Uniform(-3, 3);
+			}
+			for (int k = 0; k < dim; k++) {
+				for (int j = 0; j < n; j++) {
+					double value = Uniform(-3, 3);
+					cols[k * ld + j] = value;
+					sq[j] += value * value;
+				}
+			}
+			double xx = 0;
+			for (int k = 0; k < dim; k++) {
+				xx += x[k] * x[k];
+			}
+
+			double gamma = Uniform(0.01, 2);
+			vector<double> out(n + 1, -1), expected(n);
+			rbf_cols(x.data(), cols.data(), ld, dim, xx, sq.data(), gamma, n, out.data());
+			rbf_cols_scalar(x.data(), cols.data(), ld, dim, xx, sq.data(), gamma, n, expected.data());
+			bool near = true;
+			for (int j = 0; j < n; j++) {
+				near = near && Near(out[j], expected[j]);
+			}
+			CHECK(near);
+			CHECK(out[n] == -1);		// nothing written past n
+		}
+	}
+}
+
+static void TestNaN()
+{
+	// NaN must come out as NaN, not as a kernel value of a clamped distance
+	const int dim = 3, n = 5;
+	double x[dim] = { 1, NAN, 2 };
+	double data[n * dim];
+	const double *rows[n];
+	for (int j = 0; j < n * dim; j++) {
+		data[j] = j;
+	}
+	for (int j = 0; j < n; j++) {
+		rows[j] = &data[j * dim];
+	}
+
+	double out[n];
+	get_rbf_rows_function()(x, rows, dim, 0.5, n, out);
+	for (int j = 0; j < n; j++) {
+		CHECK(isnan(out[j]));
+	}
+
+	double sq[n] = { 1, 2, 3, 4, 5 };
+	get_rbf_cols_function()(x, data, n, dim, NAN, sq, 0.5, n, out);
+	for (int j = 0; j < n; j++) {
+		CHECK(isnan(out[j]));
+	}
+}
+
+int main()
+{
+	cout << "rbf path: " << get_rbf_rows_name() << endl;
+	srand(1);
+	TestRows();
+	TestCols();
+	TestNaN();
+	return gNumOfFailures;
+}
@@ -0,0 +1,459 @@
+﻿#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "svm.h"
+#include "thread_pool.h"
+#include "test_util.h"
+#include "test_problem.h"
+
+using namespace std;
+
+static svm_parameter DefaultParam()
+{
+	svm_parameter param;
+	memset(&param, 0, sizeof(param));
+	param.svm_type = C_SVC;
+	param.kernel_type = RBF;
+	param.gamma = 0.5;
+	param.cache_size = 100;
+	param.eps = 1e-3;
+	param.C = 2;
+	param.shrinking = 1;
+	param.nr_thread = 1;
+	param.seed = 1;
+	return param;
+}
+
+// Models equal to the last bit
+static bool SameModel(const svm_model *a, const svm_model *b)
+{
+	if (a->nr_class != b->nr_class || a->l != b->l) {
+		return false;
+	}
+	int nr_class = a->nr_class;
+	int nr_pair = nr_class * (nr_class - 1) / 2;
+	if (memcmp(a->nSV, b->nSV, sizeof(int) * nr_class) != 0
+		|| memcmp(a->sv_indices, b->sv_indices, sizeof(int) * a->l) != 0
+		|| memcmp(a->rho, b->rho, sizeof(double) * nr_pair) != 0) {
+		return false;
+	}
+	for (int k = 0; k < nr_class - 1; k++) {
+		if (memcmp(a->sv_coef[k], b->sv_coef[k], sizeof(double) * a->l) != 0) {
+			return false;
+		}
+	}
+	if ((a->probA == NULL) != (b->probA == NULL)) {
+		return false;
+	}
+	return a->probA == NULL
+		|| (memcmp(a->probA, b->probA, sizeof(double) * nr_pair) == 0 && memcmp(a->probB, b->probB, sizeof(double) * nr_pair) == 0);
+}
+
+// Largest difference of the decision values of two models over the rows x
+static double MaxDecisionDiff(const svm_model *a, const svm_model *b, const svm_node * const *x, int n)
+{
+	int nr_pair = a->nr_class * (a->nr_class - 1) / 2;
+	vector<double> aValues(nr_pair), bValues(nr_pair);
+	double maxDiff = 0;
+	for (int i = 0; i < n; i++) {
+		svm_predict_values(a, x[i], aValues.data());
+		svm_predict_values(b, x[i], bValues.data());
+		for (int k = 0; k < nr_pair; k++) {
+			maxDiff = max(maxDiff, fabs(aValues[k] - bValues[k]));
+		}
+	}
+	return maxDiff;
+}
+
+static void TestThreads()
+{
+	// Kernel columns and gradients are split over threads from 2 * 2048 rows, class pairs
+	// and Platt folds always; the models must not depend on how many threads
+	for (int nr_class = 2; nr_class <= 3; nr_class++) {
+		TestProblem problem;
+		MakeProblem(nr_class == 2 ? 4500 : 600, 6, nr_class, problem);
+		svm_parameter param = DefaultParam();
+		param.probability = (nr_class == 3);
+		param.cache_size = 1;
+
+		svm_model *serial = svm_train(&problem.prob, &param);
+		param.nr_thread = 4;
+		svm_model *parallel = svm_train(&problem.prob, &param);
+		CHECK(SameModel(serial, parallel));
+
+		svm_free_and_destroy_model(&serial);
+		svm_free_and_destroy_model(&parallel);
+	}
+}
+
+// FNV-1a of SV indices, coefficients and rho bits
+static uint64_t HashModel(const svm_model *model)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	auto hashBytes = [&hash](const void *data, size_t len) {
+		const unsigned char *p = (const unsigned char *)data;
+		for (size_t i = 0; i < len; i++) {
+			hash ^= p[i];
+			hash *= 1099511628211ULL;
+		}
+	};
+	int nr_class = model->nr_class;
+	hashBytes(model->sv_indices, sizeof(int) * model->l);
+	for (int k = 0; k < nr_class - 1; k++) {
+		hashBytes(model->sv_coef[k], sizeof(double) * model->l);
+	}
+	hashBytes(model->rho, sizeof(double) * nr_class * (nr_class - 1) / 2);
+	return hash;
+}
+
+static void TestCache()
+{
+	// A cache of two columns recomputes and swaps columns all the time under shrinking,
+	// a medium one keeps some of them and a large one everything; the models must be the same.
+	// The last problem unshrinks and then reuses columns cached at the shrunk length, which
+	// is where a logged swap cuts a column short; it takes too many iterations for the tiny
+	// cache. The hashes were recorded with libsvm's original per-column LRU cache, they hold
+	// where exp() is glibc's and a*b+c is not contracted to an FMA
+	struct Case {
+		int l, nr_class;
+		double C, gamma, eps;
+		double cacheSize[2];
+		uint64_t oldCacheHash;
+	};
+	const Case cases[] = {
+		{ 800, 2, 2, 0.5, 1e-3, { 1e-6, 0.5 }, 0xb5cc6758611e56baULL },
+		{ 600, 3, 2, 0.5, 1e-3, { 1e-6, 0.5 }, 0xe016d61171ae24faULL },
+		{ 1000, 2, 10000, 0.05, 1e-4, { 0.5, 2 }, 0x103509be3f05d3ecULL },
+	};
+	for (const Case &c : cases) {
+		TestProblem problem;
+		MakeProblem(c.l, 6, c.nr_class, problem);
+		svm_parameter param = DefaultParam();
+		param.C = c.C;
+		param.gamma = c.gamma;
+		param.eps = c.eps;
+
+		param.cache_size = 100;
+		svm_model *large = svm_train(&problem.prob, &param);
+#if defined(__GLIBC__) && defined(__x86_64__) && !defined(__FMA__)
+		CHECK(HashModel(large) == c.oldCacheHash);
+#endif
+		for (double cacheSize : c.cacheSize) {
+			param.cache_size = cacheSize;
+			svm_model *model = svm_train(&problem.prob, &param);
+			CHECK(SameModel(model, large));
+			svm_free_and_destroy_model(&model);
+		}
+		svm_free_and_destroy_model(&large);
+	}
+}
+
+static void TestWeights()
+{
+	// A row of weight W bounds its alpha by W * C, the alphas of W copies of the row
+	// add up to the same bound, so both give the same decision function up to eps
+	for (int nr_class = 2; nr_class <= 3; nr_class++) {
+		TestProblem weighted;
+		MakeProblem(300, 6, nr_class, weighted);
+		vector<double> W(weighted.prob.l);
+		vector<double> y;
+		vector<svm_node *> x;
+		for (int i = 0; i < weighted.prob.l; i++) {
+			W[i] = 1 + i % 4;
+			for (int k = 0; k < W[i]; k++) {
+				y.push_back(weighted.y[i]);
+				x.push_back(weighted.x[i]);
+			}
+		}
+		weighted.prob.W = W.data();
+		svm_problem repeated;
+		repeated.l = (int)y.size();
+		repeated.y = y.data();
+		repeated.x = x.data();
+		repeated.W = NULL;
+
+		svm_parameter param = DefaultParam();
+		param.eps = 1e-6;
+		svm_model *weightedModel = svm_train(&weighted.prob, &param);
+		svm_model *repeatedModel = svm_train(&repeated, &param);
+
+		int nr_pair = nr_class * (nr_class - 1) / 2;
+		vector<double> weightedValues(nr_pair), repeatedValues(nr_pair);
+		double maxDiff = 0;
+		for (int i = 0; i < weighted.prob.l; i++) {
+			double weightedLabel = svm_predict_values(weightedModel, weighted.x[i], weightedValues.data());
+			double repeatedLabel = svm_predict_values(repeatedModel, weighted.x[i], repeatedValues.data());
+			CHECK(weightedLabel == repeatedLabel);
+			for (int k = 0; k < nr_pair; k++) {
+				maxDiff = max(maxDiff, fabs(weightedValues[k] - repeatedValues[k]));
+			}
+		}
+		CHECK(maxDiff < 1e-4);
+
+		svm_free_and_destroy_model(&weightedModel);
+		svm_free_and_destroy_model(&repeatedModel);
+	}
+}
+
+static void TestPath()
+{
+	// Every model of the path starts from the previous one, moved to the new C,
+	// and must end where a cold start at that C ends, up to eps. Class weights and
+	// instance weights make the bounds of the two classes and of the rows differ
+	const double ascending[] = { 0.25, 1, 4, 16 };
+	const double descending[] = { 16, 4, 1, 0.25 };
+	const int nr_C = 4;
+	for (int nr_class = 2; nr_class <= 3; nr_class++) {
+		TestProblem problem;
+		MakeProblem(300, 6, nr_class, problem);
+		vector<double> W(problem.prob.l);
+		for (int i = 0; i < problem.prob.l; i++) {
+			W[i] = 0.5 + i % 3;
+		}
+		problem.prob.W = W.data();
+
+		int weightLabel[] = { 1 };
+		double weight[] = { 2.5 };
+		svm_parameter param = DefaultParam();
+		param.eps = 1e-6;
+		param.nr_weight = 1;
+		param.weight_label = weightLabel;
+		param.weight = weight;
+
+		for (const double *C : { ascending, descending }) {
+			svm_model *path[nr_C];
+			svm_train_path(&problem.prob, &param, nr_C, C, path);
+			for (int k = 0; k < nr_C; k++) {
+				svm_parameter paramOfC = param;
+				paramOfC.C = C[k];
+				svm_model *model = svm_train(&problem.prob, &paramOfC);
+				double diff = MaxDecisionDiff(path[k], model, problem.x.data(), problem.prob.l);
+				CHECK(diff < 1e-4);
+				svm_free_and_destroy_model(&model);
+				svm_free_and_destroy_model(&path[k]);
+			}
+		}
+	}
+}
+
+// Trains prob with and without the kernel matrix, the models must be the same
+static bool SameWithKernelMatrix(const svm_problem &prob, const svm_parameter &param, const svm_kernel_matrix *km)
+{
+	svm_parameter paramWithMatrix = param;
+	paramWithMatrix.kernel_matrix = km;
+	svm_model *withMatrix = svm_train(&prob, &paramWithMatrix);
+	svm_model *computed = svm_train(&prob, &param);
+	bool same = SameModel(withMatrix, computed);
+	svm_free_and_destroy_model(&withMatrix);
+	svm_free_and_destroy_model(&computed);
+	return same;
+}
+
+static void TestKernelMatrix()
+{
+	TestProblem problem;
+	MakeProblem(400, 6, 3, problem);
+	// The test problem holds multiples of 2^-14, make them differ from their float
+	for (svm_node &node : problem.nodes) {
+		node.value /= 3;
+	}
+	svm_parameter param = DefaultParam();
+	svm_kernel_matrix *km = svm_kernel_matrix_create(&problem.prob, &param);
+
+	// All rows, and a CV fold: a subset of the rows in another order
+	CHECK(SameWithKernelMatrix(problem.prob, param, km));
+	vector<double> y;
+	vector<svm_node *> x;
+	for (int i = problem.prob.l - 1; i >= 0; i--) {
+		if (i % 5 != 0) {
+			y.push_back(problem.y[i]);
+			x.push_back(problem.x[i]);
+		}
+	}
+	svm_problem fold;
+	fold.l = (int)y.size();
+	fold.y = y.data();
+	fold.x = x.data();
+	fold.W = NULL;
+	CHECK(SameWithKernelMatrix(fold, param, km));
+
+	// Other kernel parameters, or a row that is not in the matrix, compute the kernel
+	svm_parameter otherGamma = param;
+	otherGamma.gamma = 0.25;
+	CHECK(SameWithKernelMatrix(fold, otherGamma, km));
+	svm_parameter floatStorage = param;
+	floatStorage.float_storage = 1;
+	CHECK(SameWithKernelMatrix(fold, floatStorage, km));
+	vector<svm_node> copy(problem.x[1], problem.x[1] + 7);
+	x[0] = copy.data();
+	CHECK(SameWithKernelMatrix(fold, param, km));
+
+	svm_kernel_matrix_free(km);
+}
+
+// svm_predict_batch must give svm_predict's label for every row
+static void CheckPredictBatch(const svm_model *model, const vector<svm_node *> &x)
+{
+	vector<double> labels(x.size());
+	svm_predict_batch(model, x.data(), (int)x.size(), labels.data());
+	int numOfDiffs = 0;
+	for (size_t i = 0; i < x.size(); i++) {
+		numOfDiffs += (labels[i] != svm_predict(model, x[i]));
+	}
+	CHECK(numOfDiffs == 0);
+}
+
+// A prediction context must give svm_predict's decision values, up to rounding
+static void CheckPredictContext(const svm_model *model, const vector<svm_node *> &x)
+{
+	int nr_pair = model->nr_class * (model->nr_class - 1) / 2;
+	vector<double> values(nr_pair), contextValues(nr_pair);
+	svm_predict_context *context = svm_predict_context_create(model);
+	double maxDiff = 0;
+	int numOfDiffs = 0;
+	for (size_t i = 0; i < x.size(); i++) {
+		svm_predict_values(model, x[i], values.data());
+		svm_predict_values_with_context(context, x[i], contextValues.data());
+		for (int k = 0; k < nr_pair; k++) {
+			maxDiff = max(maxDiff, fabs(values[k] - contextValues[k]));
+		}
+		numOfDiffs += (svm_predict_with_context(context, x[i]) != svm_predict(model, x[i]));
+	}
+	CHECK(maxDiff < 1e-9);
+	CHECK(numOfDiffs == 0);
+	svm_predict_context_free(context);
+}
+
+static void TestPredict()
+{
+	// More rows than a tile, more SVs than a block, and values that differ from their float
+	TestProblem problem;
+	MakeProblem(800, 6, 3, problem);
+	for (svm_node &node : problem.nodes) {
+		node.value /= 3;
+	}
+
+	// Rows without feature 3 are sparse and leave the dense path
+	vector<svm_node> sparseNodes;
+	sparseNodes.reserve(100 * 7);
+	vector<svm_node *> x(problem.x);
+	for (int i = 0; i < 100; i++) {
+		size_t begin = sparseNodes.size();
+		for (const svm_node *node = problem.x[i]; node->index != -1; node++) {
+			if (node->index != 3) {
+				sparseNodes.push_back(*node);
+			}
+		}
+		sparseNodes.push_back(problem.x[i][6]);
+		x.push_back(&sparseNodes[begin]);
+	}
+
+	svm_parameter param = DefaultParam();
+	param.C = 10;
+	svm_model *model = svm_train(&problem.prob, &param);
+	CHECK(model->l > 256);
+	CheckPredictBatch(model, x);
+	CheckPredictContext(model, x);
+	svm_free_and_destroy_model(&model);
+
+	svm_parameter floatStorage = param;
+	floatStorage.float_storage = 1;
+	model = svm_train(&problem.prob, &floatStorage);
+	CheckPredictBatch(model, x);
+	CheckPredictContext(model, x);
+	svm_free_and_destroy_model(&model);
+
+	svm_parameter poly = param;
+	poly.kernel_type = POLY;
+	poly.degree = 2;
+	poly.gamma = 0.5;
+	poly.coef0 = 1;
+	model = svm_train(&problem.prob, &poly);
+	CheckPredictBatch(model, x);
+	CheckPredictContext(model, x);
+	svm_free_and_destroy_model(&model);
+}
+
+static void TestFloatStorage()
+{
+	// Float rows must act as the double rows rounded to float: the same kernel
+	// values in training, so the same model, and in prediction
+	TestProblem problem;
+	MakeProblem(600, 6, 3, problem);
+	TestProblem rounded;
+	MakeProblem(600, 6, 3, rounded);
+	for (size_t i = 0; i < problem.nodes.size(); i++) {
+		problem.nodes[i].value /= 3;
+		rounded.nodes[i].value = (float)problem.nodes[i].value;
+	}
+
+	svm_parameter param = DefaultParam();
+	param.float_storage = 1;
+	svm_model *floatModel = svm_train(&problem.prob, &param);
+	param.float_storage = 0;
+	svm_model *roundedModel = svm_train(&rounded.prob, &param);
+	CHECK(floatModel->SV_dense_f != NULL && floatModel->SV_dense == NULL);
+	CHECK(SameModel(floatModel, roundedModel));
+	CHECK(MaxDecisionDiff(floatModel, roundedModel, rounded.x.data(), rounded.prob.l) < 1e-9);
+
+	svm_free_and_destroy_model(&floatModel);
+	svm_free_and_destroy_model(&roundedModel);
+}
+
+static void TestReduce()
+{
+	TestProblem problem;
+	MakeProblem(800, 6, 2, problem);
+	svm_parameter param = DefaultParam();
+	svm_model *model = svm_train(&problem.prob, &param);
+
+	// No bound on the loss: down to nr_sv
+	double loss = -1;
+	svm_model *reduced = svm_reduce_model(model, 100, HUGE_VAL, &loss);
+	CHECK(reduced->l == 100);
+	svm_free_and_destroy_model(&reduced);
+
+	// The bound holds for every x, the SVs stay within [nr_sv, 4 * nr_sv]
+	reduced = svm_reduce_model(model, 150, 2, &loss);
+	CHECK(loss <= 2);
+	CHECK(reduced->l >= 150 && reduced->l <= 600);
+	double maxDiff = 0;
+	for (int i = 0; i < problem.prob.l; i++) {
+		double value, reducedValue;
+		svm_predict_values(model, problem.x[i], &value);
+		svm_predict_values(reduced, problem.x[i], &reducedValue);
+		maxDiff = max(maxDiff, fabs(value - reducedValue));
+	}
+	CHECK(maxDiff <= loss + 1e-9);
+	svm_free_and_destroy_model(&reduced);
+
+	// Out of reach: every SV is kept
+	reduced = svm_reduce_model(model, 20, 1e-6, &loss);
+	CHECK(reduced->l == model->l && loss == 0);
+	svm_free_and_destroy_model(&reduced);
+
+	svm_free_and_destroy_model(&model);
+}
+
+static void PrintNull(const char *)
+{
+}
+
+int main()
+{
+	// Real workers even on a single core machine
+	ThreadPool::SetNumOfWorkers(3);
+	svm_set_print_string_function(&PrintNull);
+
+	TestThreads();
+	TestCache();
+	TestWeights();
+	TestPath();
+	TestKernelMatrix();
+	TestPredict();
+	TestFloatStorage();
+	TestReduce();
+	return gNumOfFailures;
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include <vector>
+#include "svm.h"
+
+using namespace std;
+
+// Dense samples of nr_class overlapping blobs, the same on every platform
+struct TestProblem {
+	vector<double> y;
+	vector<svm_node> nodes;
+	vector<svm_node *> x;
+	svm_problem prob;
+};
+
+static inline void MakeProblem(int l, int dim, int nr_class, TestProblem &problem)
+{
+	unsigned int state = 12345;
+	problem.y.resize(l);
+	problem.nodes.resize(l * (dim + 1));
+	problem.x.resize(l);
+	for (int i = 0; i < l; i++) {
+		int label = i % nr_class;
+		problem.y[i] = label;
+		problem.x[i] = &problem.nodes[i * (dim + 1)];
+		for (int k = 0; k < dim; k++) {
+			state = state * 1103515245 + 12345;
+			double noise = ((state >> 8) & 0xffff) / 65536.0 * 4 - 2;
+			problem.x[i][k].index = k + 1;
+			problem.x[i][k].value = label * (k % 2 ? 1.0 : -0.5) + noise;
+		}
+		problem.x[i][dim].index = -1;
+	}
+	problem.prob.l = l;
+	problem.prob.y = problem.y.data();
+	problem.prob.x = problem.x.data();
+	problem.prob.W = NULL;
+}
@@ -0,0 +1,16 @@
+﻿#pragma once
+
+#include <iostream>
+
+using namespace std;
+
+// 检查失败时输出位置并计数，测试的 main 返回失败次数
+static int gNumOfFailures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			cout << __FILE__ << ":" << __LINE__ << ": CHECK(" << #cond << ") failed" << endl; \
+			gNumOfFailures++; \
+		} \
+	} while (0)
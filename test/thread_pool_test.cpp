@@ -0,0 +1,89 @@
+﻿#include <atomic>
+#include <stdexcept>
+#include <vector>
+#include "thread_pool.h"
+#include "test_util.h"
+
+using namespace std;
+
+static void TestParallelFor()
+{
+	vector<int> hits(10000, 0);
+	THREADPOOL->ParallelFor(0, hits.size(), 7, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			hits[i]++;
+		}
+	});
+
+	bool once = true;
+	for (size_t i = 0; i < hits.size(); i++) {
+		once = once && (hits[i] == 1);
+	}
+	CHECK(once);
+}
+
+static void TestNestedGroups()
+{
+	// Every task waits on a nested group, which must not deadlock even with more tasks than threads
+	atomic<int> sum(0);
+	ThreadPool::TaskGroup outer(THREADPOOL);
+	for (int i = 0; i < 64; i++) {
+		outer.Run([&sum]() {
+			ThreadPool::TaskGroup inner(THREADPOOL);
+			for (int j = 0; j < 16; j++) {
+				inner.Run([&sum]() { sum++; });
+			}
+			inner.Wait();
+		});
+	}
+	outer.Wait();
+	CHECK(sum == 64 * 16);
+}
+
+static void TestException()
+{
+	atomic<int> numOfDone(0);
+	ThreadPool::TaskGroup group(THREADPOOL);
+	for (int i = 0; i < 32; i++) {
+		group.Run([&numOfDone, i]() {
+			if (i == 5) {
+				throw runtime_error("task failed");
+			}
+			numOfDone++;
+		});
+	}
+
+	bool caught = false;
+	try {
+		group.Wait();
+	} catch (const runtime_error &) {
+		caught = true;
+	}
+	CHECK(caught);
+	CHECK(numOfDone == 31);
+
+	// The exception is reported once, the group stays usable
+	group.Run([&numOfDone]() { numOfDone++; });
+	group.Wait();
+	CHECK(numOfDone == 32);
+
+	caught = false;
+	try {
+		THREADPOOL->ParallelFor(0, 100, 1, [](size_t begin, size_t end) {
+			if (begin <= 50 && 50 < end) {
+				throw runtime_error("chunk failed");
+			}
+		});
+	} catch (const runtime_error &) {
+		caught = true;
+	}
+	CHECK(caught);
+}
+
+int main()
+{
+	TestParallelFor();
+	TestNestedGroups();
+	TestException();
+	return gNumOfFailures;
+}
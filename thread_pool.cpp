@@ -0,0 +1,280 @@
+﻿#include "thread_pool.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+static thread_local size_t tWorkerIndex = (size_t)-1;
+
+size_t ThreadPool::mNumOfWorkersCfg = (size_t)-1;
+bool ThreadPool::mPinWorkersCfg = false;
+
+static void PinThread(thread &t, size_t cpu)
+{
+#ifdef _WIN32
+	if (cpu < sizeof(DWORD_PTR) * 8) {
+		SetThreadAffinityMask((HANDLE)t.native_handle(), (DWORD_PTR)1 << cpu);
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+	(void)t;
+	(void)cpu;
+#endif
+}
+
+ThreadPool::ThreadPool(size_t numOfWorkers)
+{
+	mNumOfWorkers = numOfWorkers;
+	mNumOfPending = 0;
+	mStop = false;
+
+	for (size_t i = 0; i <= numOfWorkers; i++) {
+		mQueues.push_back(new TaskQueue());
+	}
+
+	// Worker i stays on core i+1 and core 0 is left to the caller. The cores are taken
+	// in order, the NUMA topology is not read
+	size_t numOfCores = thread::hardware_concurrency();
+	for (size_t i = 0; i < numOfWorkers; i++) {
+		mWorkers.push_back(thread(&ThreadPool::WorkerLoop, this, i));
+		if (mPinWorkersCfg && numOfCores > 0) {
+			PinThread(mWorkers.back(), (i + 1) % numOfCores);
+		}
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(mSleepMutex);
+		mStop = true;
+	}
+	mSleepCondition.notify_all();
+
+	for (size_t i = 0; i < mWorkers.size(); i++) {
+		mWorkers[i].join();
+	}
+
+	for (size_t i = 0; i < mQueues.size(); i++) {
+		delete mQueues[i];
+	}
+}
+
+ThreadPool * ThreadPool::Instance()
+{
+	// The caller of a parallel loop works too, so keep one core for it
+	static ThreadPool pool(mNumOfWorkersCfg != (size_t)-1 ? mNumOfWorkersCfg
+		: (thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 0));
+	return &pool;
+}
+
+void ThreadPool::SetNumOfWorkers(size_t numOfWorkers)
+{
+	mNumOfWorkersCfg = numOfWorkers;
+}
+
+void ThreadPool::SetPinWorkers(bool pinWorkers)
+{
+	mPinWorkersCfg = pinWorkers;
+}
+
+size_t ThreadPool::NumOfThreads() const
+{
+	return mNumOfWorkers + 1;
+}
+
+void ThreadPool::Push(Task &&task)
+{
+	// Workers push to their own queue, other threads share the last one
+	size_t index = (tWorkerIndex < mNumOfWorkers) ? tWorkerIndex : mNumOfWorkers;
+	TaskQueue *queue = mQueues[index];
+
+	// Count the task before it is visible so the counter never drops below zero
+	{
+		lock_guard<mutex> lock(mSleepMutex);
+		mNumOfPending++;
+	}
+
+	{
+		lock_guard<mutex> lock(queue->queueMutex);
+		queue->tasks.push_back(move(task));
+	}
+	mSleepCondition.notify_one();
+}
+
+bool ThreadPool::Pop(Task &task, const TaskGroup *group)
+{
+	size_t numOfQueues = mQueues.size();
+	size_t self = (tWorkerIndex < mNumOfWorkers) ? tWorkerIndex : mNumOfWorkers;
+
+	// Newest task of our own queue first, it is most likely still in cache
+	{
+		TaskQueue *queue = mQueues[self];
+		lock_guard<mutex> lock(queue->queueMutex);
+		for (auto it = queue->tasks.rbegin(); it != queue->tasks.rend(); ++it) {
+			if (group == nullptr || it->group == group) {
+				task = move(*it);
+				queue->tasks.erase(next(it).base());
+				mNumOfPending--;
+				return true;
+			}
+		}
+	}
+
+	// Steal the oldest task of the others
+	for (size_t i = 1; i < numOfQueues; i++) {
+		TaskQueue *queue = mQueues[(self + i) % numOfQueues];
+		lock_guard<mutex> lock(queue->queueMutex);
+		for (auto it = queue->tasks.begin(); it != queue->tasks.end(); ++it) {
+			if (group == nullptr || it->group == group) {
+				task = move(*it);
+				queue->tasks.erase(it);
+				mNumOfPending--;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool ThreadPool::RunOneTask(const TaskGroup *group)
+{
+	Task task;
+	if (!Pop(task, group)) {
+		return false;
+	}
+	task.run();
+	return true;
+}
+
+void ThreadPool::WorkerLoop(size_t index)
+{
+	tWorkerIndex = index;
+
+	for (;;) {
+		if (RunOneTask(nullptr)) {
+			continue;
+		}
+
+		unique_lock<mutex> lock(mSleepMutex);
+		mSleepCondition.wait(lock, [this] { return mStop || mNumOfPending > 0; });
+		if (mStop) {
+			return;
+		}
+	}
+}
+
+ThreadPool::TaskGroup::TaskGroup(ThreadPool *pool)
+{
+	mPool = pool;
+	mNumOfRunning = 0;
+	mNumOfQueued = 0;
+}
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+	// Never throw from here, an exception nobody waited for is dropped
+	WaitAll();
+}
+
+void ThreadPool::TaskGroup::Run(function<void()> fn)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		mNumOfRunning++;
+		mNumOfQueued++;
+	}
+
+	Task task;
+	task.group = this;
+	task.run = [this, fn]() {
+		{
+			lock_guard<mutex> lock(mMutex);
+			mNumOfQueued--;
+		}
+
+		exception_ptr exception;
+		try {
+			fn();
+		} catch (...) {
+			exception = current_exception();
+		}
+
+		// Notify under the lock, the group may be destroyed as soon as it is released
+		lock_guard<mutex> lock(mMutex);
+		if (exception && !mException) {
+			mException = exception;
+		}
+		mNumOfRunning--;
+		mCondition.notify_all();
+	};
+	mPool->Push(move(task));
+
+	// A waiter may sleep while tasks of the group submit more
+	lock_guard<mutex> lock(mMutex);
+	mCondition.notify_all();
+}
+
+void ThreadPool::TaskGroup::WaitAll()
+{
+	// Run our own queued tasks, nested groups can not deadlock this way since every
+	// queued task of a waited group has a waiter able to run it
+	for (;;) {
+		if (mPool->RunOneTask(this)) {
+			continue;
+		}
+
+		unique_lock<mutex> lock(mMutex);
+		mCondition.wait(lock, [this] { return mNumOfRunning == 0 || mNumOfQueued > 0; });
+		if (mNumOfRunning == 0) {
+			return;
+		}
+	}
+}
+
+void ThreadPool::TaskGroup::Wait()
+{
+	WaitAll();
+
+	exception_ptr exception;
+	{
+		lock_guard<mutex> lock(mMutex);
+		exception = mException;
+		mException = nullptr;
+	}
+	if (exception) {
+		rethrow_exception(exception);
+	}
+}
+
+void ThreadPool::ParallelFor(size_t begin, size_t end, size_t grain, const function<void(size_t, size_t)> &body)
+{
+	if (grain == 0) {
+		grain = 1;
+	}
+
+	if (end <= begin + grain || mNumOfWorkers == 0) {
+		if (end > begin) {
+			body(begin, end);
+		}
+		return;
+	}
+
+	TaskGroup group(this);
+	for (size_t chunkBegin = begin; chunkBegin < end; chunkBegin += grain) {
+		size_t chunkEnd = (end - chunkBegin > grain) ? chunkBegin + grain : end;
+		group.Run([&body, chunkBegin, chunkEnd]() {
+			body(chunkBegin, chunkEnd);
+		});
+	}
+	group.Wait();
+}
@@ -0,0 +1,91 @@
+﻿#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#define THREADPOOL (ThreadPool::Instance())
+
+// Work-stealing thread pool. Every worker owns a task queue, pops its own tasks
+// from the back and steals from the front of the others when it runs dry.
+// A thread waiting on a TaskGroup runs the queued tasks of that group only, then
+// sleeps until the rest finish, so tasks may submit and wait for nested tasks
+// without picking up unrelated work.
+class ThreadPool {
+	/* Singleton */
+private:
+	ThreadPool(size_t numOfWorkers);
+	~ThreadPool();
+
+public:
+	static ThreadPool * Instance();
+	static void SetNumOfWorkers(size_t numOfWorkers);	// 在第一次 Instance() 之前调用才有效
+	static void SetPinWorkers(bool pinWorkers);			// 同上
+
+	/* Configure parameters */
+private:
+	static size_t mNumOfWorkersCfg;		// 工作线程数，默认为核数减一
+	static bool mPinWorkersCfg;			// 工作线程 i 绑定到核 (i+1)%核数，只是绑核，不区分 NUMA 节点
+
+	/* Task */
+public:
+	class TaskGroup;
+
+private:
+	struct Task {
+		function<void()> run;
+		TaskGroup *group;			// 所属的任务组
+	};
+
+	struct TaskQueue {
+		mutex queueMutex;
+		deque<Task> tasks;
+	};
+
+	vector<thread> mWorkers;
+	size_t mNumOfWorkers;				// 线程启动前确定，mWorkers 在启动过程中还会增长
+	vector<TaskQueue *> mQueues;		// 每个线程一个队列，最后一个给外部线程提交任务
+	atomic<size_t> mNumOfPending;
+	mutex mSleepMutex;
+	condition_variable mSleepCondition;
+	bool mStop;
+
+	void Push(Task &&task);
+	bool Pop(Task &task, const TaskGroup *group);	// group 为 nullptr 时取任意任务
+	bool RunOneTask(const TaskGroup *group);
+	void WorkerLoop(size_t index);
+
+public:
+	class TaskGroup {
+	public:
+		TaskGroup(ThreadPool *pool);
+		~TaskGroup();
+
+		void Run(function<void()> fn);
+		void Wait();					// 重新抛出任务中第一个异常
+
+	private:
+		void WaitAll();
+
+		ThreadPool *mPool;
+		mutex mMutex;
+		condition_variable mCondition;
+		size_t mNumOfRunning;			// 已提交未完成的任务数
+		size_t mNumOfQueued;			// 其中还在队列里的任务数
+		exception_ptr mException;
+	};
+
+	// Number of threads working on a parallel loop, including the caller
+	size_t NumOfThreads() const;
+
+	// Call body(chunkBegin, chunkEnd) for [begin, end) split into chunks of grain
+	void ParallelFor(size_t begin, size_t end, size_t grain, const function<void(size_t, size_t)> &body);
+};